@@ -1,7 +1,22 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <ctype.h>
+#include <time.h>
+#include <setjmp.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#endif
 
 #define MAX_PRODUCTIONS 100
 #define MAX_SYMBOLS 100
@@ -27,94 +42,863 @@ typedef struct {
     char start_symbol[MAX_SYMBOL_LENGTH];
 } Grammar;
 
+#define MAX_ALTERNATIVES (MAX_PRODUCTIONS * MAX_RHS)
+#define MAX_LOOKAHEAD 3
+
+// Symbol codes used by the indexed grammar: non-terminal i is encoded as i,
+// terminal j as TERMINAL_CODE(j) and '$' as TERMINAL_CODE(terminal_count).
+#define TERMINAL_CODE(j) (MAX_SYMBOLS + (j))
+#define IS_TERMINAL_CODE(s) ((s) >= MAX_SYMBOLS)
+
+// One alternative with its symbols resolved to codes (epsilon is dropped,
+// so an epsilon alternative has length 0).
+typedef struct {
+    int lhs;
+    int code;       // prodIndex * 1000 + altIndex, same encoding as the parsing table
+    int length;
+    int symbols[MAX_SYMBOL_LENGTH];
+} IndexedAlternative;
+
+// Structure to represent the grammar with all symbols resolved to indices
+typedef struct {
+    IndexedAlternative alts[MAX_ALTERNATIVES];
+    int alt_count;
+    int non_terminal_count;
+    int terminal_count;
+    int start;
+} IndexedGrammar;
+
+// Node of the lookahead trie: a k-token sequence is the path from the root
+// (the empty sequence) to its node, so a sequence is identified by one int.
+typedef struct {
+    int parent;
+    int terminal;   // column of the last token, -1 for the root
+    int length;
+} SeqNode;
+
+typedef struct {
+    SeqNode *nodes;
+    int node_count;
+    int node_capacity;
+    int *buckets;   // hash of (parent, terminal) -> first node in the chain
+    int *chain;
+    int bucket_count;
+    int k;
+    int end_column; // column of '$'
+} SeqTrie;
+
+// Set of lookahead sequences, stored as sorted trie node ids
+typedef struct {
+    int *items;
+    int count;
+    int capacity;
+} SeqSet;
+
+// Node of a lookahead decision tree built for one conflicting LL(1) cell
+typedef struct {
+    int terminal;       // column matched on the edge into this node
+    int decision;       // table entry at a leaf, -1 for inner nodes, -2 if still ambiguous
+    int first_child;
+    int child_count;
+} LookaheadNode;
+
+typedef struct {
+    int nt_index;
+    int col;
+    int root;
+    int depth;          // tokens of lookahead the tree inspects
+    int resolved;
+} LookaheadCell;
+
+typedef struct {
+    int k;
+    SeqTrie trie;
+    SeqSet first_k[MAX_SYMBOLS];
+    SeqSet follow_k[MAX_SYMBOLS];
+    LookaheadNode *nodes;
+    int node_count;
+    int node_capacity;
+    LookaheadCell *cells;
+    int cell_count;
+    int cell_capacity;
+} LLkAnalysis;
+
+// Every alternative that competes for one parsing table cell
+typedef struct {
+    int nt_index;
+    int col;
+    int codes[MAX_RHS];
+    int via_follow[MAX_RHS];    // 1 if the entry came from FOLLOW(lhs) rather than FIRST(alt)
+    int count;
+} ConflictCell;
+
+typedef struct {
+    ConflictCell *cells;
+    int cell_count;
+    int cell_capacity;
+} ConflictReport;
+
+// Set of terminal columns ('$' included) as a bitset
+#define SET_WORDS ((MAX_SYMBOLS + 63) / 64)
+typedef struct {
+    unsigned long long bits[SET_WORDS];
+} TermSet;
+
+static inline void term_set_add(TermSet *s, int col) {
+    s->bits[col / 64] |= 1ULL << (col % 64);
+}
+
+static inline int term_set_has(const TermSet *s, int col) {
+    return (s->bits[col / 64] >> (col % 64)) & 1;
+}
+
+// Adds src to dst and returns 1 if dst changed.
+static inline int term_set_union(TermSet *dst, const TermSet *src) {
+    int changed = 0;
+    for (int i = 0; i < SET_WORDS; i++) {
+        unsigned long long merged = dst->bits[i] | src->bits[i];
+        changed |= merged != dst->bits[i];
+        dst->bits[i] = merged;
+    }
+    return changed;
+}
+
+// FIRST and nullable of every suffix of every alternative, plus FIRST/FOLLOW
+// of the non-terminals as bitsets
+typedef struct {
+    IndexedGrammar *ig;
+    TermSet first[MAX_SYMBOLS];
+    char nullable[MAX_SYMBOLS];
+    TermSet follow[MAX_SYMBOLS];
+    int suffix_start[MAX_ALTERNATIVES];   // FIRST(symbols[i..]) is suffix_first[suffix_start[alt] + i]
+    TermSet *suffix_first;
+    unsigned char *suffix_nullable;
+    int suffix_capacity;
+} SuffixSets;
+
+// Parsing table with identical terminal columns and non-terminal rows shared
+typedef struct {
+    unsigned char column_class[MAX_SYMBOLS + 1];  // terminal column -> equivalence class
+    unsigned char row_of[MAX_SYMBOLS];            // non-terminal -> shared row
+    int class_count;
+    int row_count;
+    int end_column;
+    short *cells;       // row_count x class_count alternative indices, -1 for errors
+} CompressedTable;
+
+static inline int compressed_table_lookup(CompressedTable *t, int nt_index, int col) {
+    return t->cells[t->row_of[nt_index] * t->class_count + t->column_class[col]];
+}
+
+// Growable array the GLL parser allocates its nodes from; all of it is
+// released at once when a parse starts over
+typedef struct {
+    void *items;
+    int count;
+    int capacity;
+    size_t size;        // bytes per item
+} GllPool;
+
+// Open-addressing index over a pool: slots hold (hash, pool index + 1)
+typedef struct {
+    unsigned *hashes;
+    int *slots;
+    unsigned mask;
+    int count;
+} GllHash;
+
+// Generalized LL parser for the conflicting cells of the table, with the
+// deterministic driver running everything else
+typedef struct {
+    IndexedGrammar *ig;
+    CompressedTable *table;
+    const char *nullable;
+    TermSet *predict;                   // per alternative: FIRST, plus FOLLOW(lhs) if nullable
+    int *alts_start;                    // alternatives of non-terminal A are alts_list[alts_start[A] ..
+    int *alts_list;                     //  alts_start[A + 1])
+    char conflict[MAX_SYMBOLS][MAX_SYMBOLS + 1];
+    size_t memory_limit;
+    size_t bytes;                       // currently allocated by pools, indices and stacks
+    size_t peak_bytes;
+    jmp_buf *limit_trap;
+
+    int *stack;                         // deterministic driver's stack
+    int stack_capacity;
+    int *cont;                          // driver stack handed to GLL, top first
+    int cont_length;
+    int cont_capacity;
+
+    GllPool gss, edges, pops, sppf, packed, descriptors;
+    GllHash gss_index, edge_index, pop_index, sppf_index, packed_index, descriptor_index;
+    int *pending;                       // descriptors still to process
+    int pending_count;
+    int pending_capacity;
+    char *seen;                         // forest nodes reached from the root
+    int seen_capacity;
+
+    int root;                           // SPPF node of the accepted remainder, -1 if none
+    int furthest;                       // furthest input position any path reached
+    // totals over the last parse
+    int regions;
+    int handbacks;
+    long descriptor_total, gss_total, sppf_total, packed_total;
+    int ambiguous;
+} GllParser;
+
+// A run of consecutive tokens of an incrementally parsed input, with the
+// driver stack at the moment the parse reached its first token and the
+// alternatives expanded while the lookahead was inside it
+typedef struct {
+    int *tokens;
+    int token_count;
+    int *stack;         // NULL if no parse has reached this segment yet
+    int depth;
+    int *alts;
+    int alt_count;
+    int alt_capacity;
+    int rejected_at;    // token the recorded parse was rejected at, or -1
+} ParseSegment;
+
+// Token stream and parse kept as segments of about segment_size tokens, so an
+// edit only reparses from the segment it starts in
+typedef struct {
+    IndexedGrammar *ig;
+    CompressedTable *table;
+    int segment_size;
+    ParseSegment *segments;
+    int segment_count;
+    int segment_capacity;
+    int token_count;    // including the final '$'
+    int result;         // as returned by ll1_parse
+    // work done by the last parse or edit
+    int reparsed_tokens;
+    int reused_segments;
+} IncrementalParse;
+
+// Operator levels marked in the grammar file with "operator LHS left|right OP...".
+// LHS -> LHS OP NEXT | NEXT is then parsed by precedence climbing, NEXT being
+// either the next level or the operand
+#define MAX_OPERATOR_LEVELS 16
+typedef struct {
+    char lhs[MAX_OPERATOR_LEVELS][MAX_SYMBOL_LENGTH];
+    char operand[MAX_OPERATOR_LEVELS][MAX_SYMBOL_LENGTH];   // NEXT, filled in by check_operator_levels
+    char ops[MAX_OPERATOR_LEVELS][MAX_RHS][MAX_SYMBOL_LENGTH];
+    int op_count[MAX_OPERATOR_LEVELS];
+    int right_assoc[MAX_OPERATOR_LEVELS];
+    int count;
+} OperatorLevels;
+
+// Operator levels resolved against the transformed grammar. Levels of one
+// chain are stored from the loosest binding to the tightest.
+typedef struct {
+    int level_count;
+    int level_of[MAX_SYMBOLS];              // non-terminal -> level, -1 if table-driven
+    int chain_end[MAX_OPERATOR_LEVELS];     // one past the last level of the chain
+    int primary[MAX_OPERATOR_LEVELS];       // operand of the chain's tightest level
+    int right_assoc[MAX_OPERATOR_LEVELS];
+    TermSet ops[MAX_OPERATOR_LEVELS];
+} PrattTable;
+
+// Operators applied by the precedence climber, as input positions in the order
+// their right operands were complete (postfix order), which fixes the grouping:
+// in "x - x - x" the first '-' comes first if the level is left associative
+typedef struct {
+    int *positions;
+    int count;
+    int capacity;
+} OperatorOrder;
+
+// How often each parsing table cell was used, recorded by ll1_parse
+typedef struct {
+    long cell[MAX_SYMBOLS][MAX_SYMBOLS + 1];   // [non-terminal][terminal column]
+} ParseProfile;
+
+// Compressed table and right-hand sides laid out by a profile: the classes of
+// the hot cells form a dense block of their own, hot rows first, ahead of the
+// other classes; hot alternatives first in the flat RHS storage
+typedef struct {
+    int *cells;         // rhs offset << 8 | leading terminal matched << 7 | length, or -1
+    int *rhs;           // symbols in push order: row offsets for non-terminals, -1 - column for terminals
+    int rhs_count;
+    unsigned char class_of[MAX_SYMBOLS + 1];    // terminal column -> class in the new order
+    int row_offset[MAX_SYMBOLS];                // non-terminal -> first cell of its row in the hot block
+    int row_count;
+    int class_count;
+    int hot_classes;                            // classes 0..hot_classes-1 are in the hot block
+    int end_column;
+    int start;                                  // row offset of the start symbol
+} ProfiledTable;
+
+// Analyses derived from the grammar, as bits of PassManager.valid
+#define ANALYSIS_INDEX  1   // IndexedGrammar
+#define ANALYSIS_FIRST  2   // FIRST sets and suffix tables
+#define ANALYSIS_FOLLOW 4
+#define ANALYSIS_TABLE  8   // parsing table and conflicts
+#define ANALYSIS_ALL    (ANALYSIS_INDEX | ANALYSIS_FIRST | ANALYSIS_FOLLOW | ANALYSIS_TABLE)
+
+// A transformation that rewrites the grammar in place and returns 1 if it changed it
+typedef struct {
+    const char *name;
+    int (*run)(Grammar *g);
+    int invalidates;    // ANALYSIS_* bits that no longer hold after a change
+} GrammarPass;
+
+// One mutable grammar and the analyses computed from it so far
+typedef struct {
+    Grammar grammar;
+    int valid;          // ANALYSIS_* bits that are up to date
+    IndexedGrammar ig;
+    char first_sets[MAX_SYMBOLS][MAX_SYMBOLS][MAX_SYMBOL_LENGTH];
+    int first_count[MAX_SYMBOLS];
+    SuffixSets suffix;
+    char follow_sets[MAX_SYMBOLS][MAX_SYMBOLS][MAX_SYMBOL_LENGTH];
+    int follow_count[MAX_SYMBOLS];
+    int parsing_table[MAX_SYMBOLS][MAX_SYMBOLS];
+    ConflictReport conflicts;
+} PassManager;
+
 // Function to read grammar from file
 Grammar read_grammar_from_file(const char* filename);
+Grammar read_grammar(FILE *file);
+
+// Capacity errors exit unless capacity_trap points to a jmp_buf to return to;
+// capacity_what then names the exceeded limit
+extern jmp_buf *capacity_trap;
+extern const char *capacity_what;
+void capacity_error(const char *what);
 
 // Function to perform left factoring
 Grammar left_factoring(Grammar g);
+int left_factoring_in_place(Grammar *g);
 
 // Function to remove left recursion
 Grammar remove_left_recursion(Grammar g);
+int remove_left_recursion_in_place(Grammar *g);
+
+// Functions to remove useless symbols, inline unit productions and merge
+// equivalent non-terminals; reduce_grammar runs all of them
+int remove_useless_symbols_in_place(Grammar *g);
+int inline_unit_productions_in_place(Grammar *g);
+int merge_equivalent_non_terminals_in_place(Grammar *g);
+int reduce_grammar_in_place(Grammar *g);
+Grammar reduce_grammar(Grammar g);
+
+// Transformation passes and the pass manager running them
+extern const GrammarPass left_factoring_pass;
+extern const GrammarPass left_recursion_pass;
+extern const GrammarPass reduce_pass;
+void pass_manager_init(PassManager *pm);
+int run_pass(PassManager *pm, const GrammarPass *pass, Grammar *snapshot);
+void require_analyses(PassManager *pm, int analyses);
+void free_pass_manager(PassManager *pm);
 
 // Function to compute FIRST sets
-void compute_first_sets(Grammar g, char first_sets[MAX_SYMBOLS][MAX_SYMBOLS][MAX_SYMBOL_LENGTH], int first_count[MAX_SYMBOLS]);
+void compute_first_sets(Grammar *g, char first_sets[MAX_SYMBOLS][MAX_SYMBOLS][MAX_SYMBOL_LENGTH], int first_count[MAX_SYMBOLS]);
+
+// Function to compute FIRST and nullable of every alternative suffix
+void compute_suffix_sets(Grammar *g, IndexedGrammar *ig,
+                         char first_sets[MAX_SYMBOLS][MAX_SYMBOLS][MAX_SYMBOL_LENGTH], int first_count[MAX_SYMBOLS],
+                         SuffixSets *s);
+void free_suffix_sets(SuffixSets *s);
 
 // Function to compute FOLLOW sets
-void compute_follow_sets(Grammar g, char first_sets[MAX_SYMBOLS][MAX_SYMBOLS][MAX_SYMBOL_LENGTH], int first_count[MAX_SYMBOLS], 
+void compute_follow_sets(Grammar *g, SuffixSets *suffix,
                        char follow_sets[MAX_SYMBOLS][MAX_SYMBOLS][MAX_SYMBOL_LENGTH], int follow_count[MAX_SYMBOLS]);
 
-// Function to construct LL(1) parsing table
-void construct_parsing_table(Grammar g, char first_sets[MAX_SYMBOLS][MAX_SYMBOLS][MAX_SYMBOL_LENGTH], int first_count[MAX_SYMBOLS],
-                          char follow_sets[MAX_SYMBOLS][MAX_SYMBOLS][MAX_SYMBOL_LENGTH], int follow_count[MAX_SYMBOLS],
-                          int parsing_table[MAX_SYMBOLS][MAX_SYMBOLS]);
+// Function to construct LL(1) parsing table; conflicts are also printed
+// unless report_table_conflicts is 0
+extern int report_table_conflicts;
+void construct_parsing_table(Grammar *g, SuffixSets *suffix,
+                          int parsing_table[MAX_SYMBOLS][MAX_SYMBOLS], ConflictReport *conflicts);
+
+// Function to check LL(1) conflict-freedom from the predict sets alone
+#define LL1_CHECK_OK 0
+#define LL1_CHECK_CONFLICT 1
+int check_ll1(SuffixSets *suffix, ConflictReport *conflicts);
 
 // Function to print grammar
-void print_grammar(Grammar g);
+void print_grammar(Grammar *g);
 
 // Function to print parsing table
-void print_parsing_table(Grammar g, int parsing_table[MAX_SYMBOLS][MAX_SYMBOLS]);
+void print_parsing_table(Grammar *g, int parsing_table[MAX_SYMBOLS][MAX_SYMBOLS]);
+
+// Function to print FIRST or FOLLOW sets as "NAME(A) = { a , b }" lines
+void print_symbol_sets(Grammar *g, const char *name, char sets[MAX_SYMBOLS][MAX_SYMBOLS][MAX_SYMBOL_LENGTH],
+                       int count[MAX_SYMBOLS]);
 
 // Utility functions
 int is_non_terminal(char* symbol);
-int get_non_terminal_index(Grammar g, char* symbol);
-int get_terminal_index(Grammar g, char* symbol);
+int get_non_terminal_index(Grammar *g, const char *symbol);
+int get_terminal_index(Grammar *g, char* symbol);
 int contains_epsilon(char set[MAX_SYMBOLS][MAX_SYMBOL_LENGTH], int count);
 void add_to_set(char set[MAX_SYMBOLS][MAX_SYMBOL_LENGTH], int* count, char* symbol);
+void *checked_realloc(void *ptr, size_t size);
+int get_symbol_code(Grammar *g, char *symbol);
+void print_alternative(Grammar *g, int code);
+const char *column_name(Grammar *g, int col);
 
-int main() {
-    // Read grammar from file
-    Grammar g = read_grammar_from_file("D:\\Semester 6\\CC\\A2\\grammer.txt");
-    printf("Original Grammar:\n");
-    print_grammar(g);
-    
-    // Perform left factoring
-    Grammar g_factored = left_factoring(g);
-    printf("\nGrammar after Left Factoring:\n");
-    print_grammar(g_factored);
-    
-    // Remove left recursion
-    Grammar g_no_left_recursion = remove_left_recursion(g_factored);
-    printf("\nGrammar after Left Recursion Removal:\n");
-    print_grammar(g_no_left_recursion);
+// Function to resolve every alternative of the grammar to symbol codes
+void index_grammar(Grammar *g, IndexedGrammar *ig);
+
+// Functions for the LL(k) lookahead analysis of conflicting LL(1) cells
+void compute_llk_analysis(IndexedGrammar *ig, int k, LLkAnalysis *a);
+void print_llk_report(Grammar *g, LLkAnalysis *a);
+void free_llk_analysis(LLkAnalysis *a);
+
+// Function to write the conflicts of the parsing table as JSON
+void write_conflict_report_json(FILE *out, Grammar *g, SuffixSets *suffix, ConflictReport *conflicts);
+
+// Functions for the compressed table and the table-driven parser
+void build_compressed_table(Grammar *g, IndexedGrammar *ig, int parsing_table[MAX_SYMBOLS][MAX_SYMBOLS],
+                            int compress, CompressedTable *t);
+size_t compressed_table_bytes(CompressedTable *t);
+void print_compression_report(Grammar *g, CompressedTable *t);
+void free_compressed_table(CompressedTable *t);
+int *read_token_file(Grammar *g, const char *filename, int *count);
+int ll1_parse(IndexedGrammar *ig, CompressedTable *t, int *input, int count, ParseProfile *profile);
+void benchmark_parser(Grammar *g, IndexedGrammar *ig, SuffixSets *suffix, ConflictReport *conflicts,
+                      int parsing_table[MAX_SYMBOLS][MAX_SYMBOLS], PrattTable *pratt, ParseProfile *profile,
+                      int *tokens, int count, int iterations);
+
+// Functions for incremental reparsing
+#define INCREMENTAL_SEGMENT 1024
+int incremental_parse(IncrementalParse *doc, IndexedGrammar *ig, CompressedTable *t, int *tokens, int count,
+                      int segment_size);
+int incremental_edit(IncrementalParse *doc, int start, int removed, int *inserted, int inserted_count);
+int incremental_derivation(IncrementalParse *doc, int **alts);
+void apply_edit_file(Grammar *g, IncrementalParse *doc, const char *filename);
+void free_incremental_parse(IncrementalParse *doc);
+
+// Functions for the operator-precedence hybrid parser
+void read_operator_levels(FILE *file, OperatorLevels *levels);
+void check_operator_levels(Grammar *g, OperatorLevels *levels);
+void build_pratt_table(Grammar *g, OperatorLevels *levels, PrattTable *pt);
+int pratt_parse(IndexedGrammar *ig, CompressedTable *t, PrattTable *pt, int *input, int count, OperatorOrder *order);
+
+// Functions for profile-guided table layout
+void load_parse_profile(Grammar *g, const char *filename, ParseProfile *profile);
+void save_parse_profile(Grammar *g, const char *filename, ParseProfile *profile);
+void build_profiled_table(IndexedGrammar *ig, CompressedTable *t, ParseProfile *profile, ProfiledTable *pt);
+void print_layout_report(Grammar *g, CompressedTable *t, ProfiledTable *pt, ParseProfile *profile);
+int profiled_parse(ProfiledTable *pt, int *input, int count);
+void free_profiled_table(ProfiledTable *pt);
+
+// Buffered output: collects writes in a large buffer and hands it to a FILE or
+// straight to a file descriptor
+#define WRITER_BUFFER_SIZE 65536
+typedef struct {
+    FILE *file;         // NULL when writing to fd
+    int fd;
+    int failed;
+    size_t used;
+    char data[WRITER_BUFFER_SIZE];
+} Writer;
+
+void writer_init_file(Writer *w, FILE *file);
+void writer_init_fd(Writer *w, int fd);
+void writer_write(Writer *w, const void *data, size_t length);
+void writer_str(Writer *w, const char *s);
+void writer_int(Writer *w, int value);
+void writer_flush(Writer *w);
+
+static inline void writer_char(Writer *w, char c) {
+    if (w->used == WRITER_BUFFER_SIZE) writer_flush(w);
+    w->data[w->used++] = c;
+}
+
+// Machine-readable exports of the sets and the table
+#define EXPORT_JSON 0
+#define EXPORT_CSV 1
+#define EXPORT_DOT 2
+#define EXPORT_BINARY 3
+int export_format_from_name(const char *name);
+void export_analysis(Writer *w, int format, PassManager *pm);
+
+// Functions for the GLL fallback parser; gll_parse returns like ll1_parse, or
+// GLL_LIMIT_EXCEEDED when the parse needs more than memory_limit bytes
+#define GLL_LIMIT_EXCEEDED (-0x7fffffff)
+void gll_init(GllParser *p, IndexedGrammar *ig, SuffixSets *suffix, ConflictReport *conflicts,
+              CompressedTable *table, size_t memory_limit);
+int gll_parse(GllParser *p, int *input, int count);
+void write_sppf_dot(Writer *w, Grammar *g, GllParser *p);
+void free_gll_parser(GllParser *p);
+
+// Grammar modules: a file may import others, each is transformed and analysed
+// on its own (optionally cached in a directory) and the results are linked
+#define MAX_MODULES 32
+typedef struct {
+    char path[256];
+    Grammar *grammar;       // this module's productions after the transformations
+    char start[MAX_SYMBOL_LENGTH];
+    int imports[MAX_MODULES];
+    int import_count;
+    int state;              // 0 not loaded, 1 loading, 2 analysed
+    int from_cache;
+    unsigned long long content_hash;
+    unsigned long long summary_hash;
+    // nullable and FIRST of the non-terminals this module defines
+    int summary_count;
+    char summary_names[MAX_SYMBOLS][MAX_SYMBOL_LENGTH];
+    char summary_nullable[MAX_SYMBOLS];
+    char summary_first[MAX_SYMBOLS][MAX_SYMBOLS][MAX_SYMBOL_LENGTH];
+    int summary_first_count[MAX_SYMBOLS];
+} GrammarModule;
+
+typedef struct {
+    GrammarModule *modules[MAX_MODULES];
+    int count;
+    const char *cache_dir;  // NULL to analyse every module
+} ModuleSet;
+
+int grammar_file_has_imports(const char *filename);
+void load_grammar_modules(ModuleSet *set, const char *filename);
+void link_grammar_modules(ModuleSet *set, PassManager *pm);
+void free_grammar_modules(ModuleSet *set);
+
+// Functions for the resident generation server and its client
+int serve_grammars(const char *path, int threads, int allow_shutdown);
+int request_from_server(const char *path, const char *command, const char *grammar_file);
+
+#ifndef FUZZ_HARNESS
+int main(int argc, char *argv[]) {
+    const char *grammar_file = "D:\\Semester 6\\CC\\A2\\grammer.txt";
+    int lookahead_k = 1;
+    const char *conflicts_json = NULL;
+    int reduce = 0;
+    int compress = 0;
+    const char *parse_file = NULL;
+    const char *bench_file = NULL;
+    int bench_iterations = 1000;
+    int check = 0;      // 1 stops at the first conflict, 2 collects all of them
+    const char *serve_path = NULL;
+    int allow_shutdown = 0;
+    const char *connect_path = NULL;
+    const char *request = "table";
+    int threads = 4;
+    const char *module_cache = NULL;
+    int export_format = -1;
+    size_t gll_limit = (size_t)256 << 20;
+    const char *sppf_file = NULL;
+    const char *edit_file = NULL;
+    const char *profile_file = NULL;
+    const char *profile_out = NULL;
+    const char *export_to = "-";
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--llk") == 0 && i + 1 < argc) {
+            lookahead_k = atoi(argv[++i]);
+            if (lookahead_k < 1 || lookahead_k > MAX_LOOKAHEAD) {
+                printf("Lookahead must be between 1 and %d\n", MAX_LOOKAHEAD);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--compress") == 0) {
+            compress = 1;
+        } else if (strcmp(argv[i], "--parse") == 0 && i + 1 < argc) {
+            parse_file = argv[++i];
+        } else if (strcmp(argv[i], "--edits") == 0 && i + 1 < argc) {
+            edit_file = argv[++i];
+        } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            profile_file = argv[++i];
+        } else if (strcmp(argv[i], "--profile-out") == 0 && i + 1 < argc) {
+            profile_out = argv[++i];
+        } else if (strcmp(argv[i], "--bench") == 0 && i + 1 < argc) {
+            bench_file = argv[++i];
+        } else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+            bench_iterations = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--reduce") == 0) {
+            reduce = 1;
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            serve_path = argv[++i];
+        } else if (strcmp(argv[i], "--allow-shutdown") == 0) {
+            allow_shutdown = 1;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--connect") == 0 && i + 1 < argc) {
+            connect_path = argv[++i];
+        } else if (strcmp(argv[i], "--request") == 0 && i + 1 < argc) {
+            request = argv[++i];
+        } else if (strcmp(argv[i], "--export") == 0 && i + 1 < argc) {
+            export_format = export_format_from_name(argv[++i]);
+            if (export_format < 0) {
+                printf("Unknown export format %s (json, csv, dot or binary)\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--gll-limit") == 0 && i + 1 < argc) {
+            long megabytes = atol(argv[++i]);
+            if (megabytes < 1 || (size_t)megabytes > SIZE_MAX >> 20) {
+                printf("GLL memory limit must be a positive number of MB\n");
+                return 1;
+            }
+            gll_limit = (size_t)megabytes << 20;
+        } else if (strcmp(argv[i], "--sppf") == 0 && i + 1 < argc) {
+            sppf_file = argv[++i];
+        } else if (strcmp(argv[i], "--export-to") == 0 && i + 1 < argc) {
+            export_to = argv[++i];
+        } else if (strcmp(argv[i], "--module-cache") == 0 && i + 1 < argc) {
+            module_cache = argv[++i];
+        } else if (strcmp(argv[i], "--check") == 0) {
+            check = 1;
+        } else if (strcmp(argv[i], "--check-all") == 0) {
+            check = 2;
+        } else if (strcmp(argv[i], "--conflicts-json") == 0 && i + 1 < argc) {
+            conflicts_json = argv[++i];
+        } else {
+            grammar_file = argv[i];
+        }
+    }
+
+    // Hand the grammar to a running server, or become one
+    if (serve_path) {
+        return serve_grammars(serve_path, threads, allow_shutdown);
+    }
+    if (connect_path) {
+        return request_from_server(connect_path, request, grammar_file);
+    }
+
+    // Read grammar from file; every pass below rewrites it in place
+    static PassManager pm;
+    static OperatorLevels operators;
+    static PrattTable pratt;
+    static ParseProfile profile;
+    pass_manager_init(&pm);
+    int linked = module_cache || grammar_file_has_imports(grammar_file);
+    if (linked) {
+        // Modules arrive already transformed, with FIRST linked from their analyses
+        static ModuleSet modules;
+        modules.cache_dir = module_cache;
+        load_grammar_modules(&modules, grammar_file);
+        link_grammar_modules(&modules, &pm);
+        int cached = 0;
+        for (int i = 0; i < modules.count; i++) cached += modules.modules[i]->from_cache;
+        printf("Linked %d modules (%d from cache)\n", modules.count, cached);
+        free_grammar_modules(&modules);
+    } else {
+        pm.grammar = read_grammar_from_file(grammar_file);
+        FILE *file = fopen(grammar_file, "r");
+        read_operator_levels(file, &operators);
+        fclose(file);
+        if (operators.count) check_operator_levels(&pm.grammar, &operators);
+    }
+    Grammar *g = &pm.grammar;
+
+    // Check-only mode: transform, test the predict sets and exit with the status
+    if (check) {
+        run_pass(&pm, &left_factoring_pass, NULL);
+        run_pass(&pm, &left_recursion_pass, NULL);
+        if (reduce) run_pass(&pm, &reduce_pass, NULL);
+        require_analyses(&pm, ANALYSIS_FOLLOW);
+        int status = check_ll1(&pm.suffix, check == 2 ? &pm.conflicts : NULL);
+        for (int i = 0; i < pm.conflicts.cell_count; i++) {
+            ConflictCell *cell = &pm.conflicts.cells[i];
+            printf("Conflict at [%s, %s]: ", g->non_terminals[cell->nt_index], column_name(g, cell->col));
+            for (int j = 0; j < cell->count; j++) {
+                if (j > 0) printf(" | ");
+                print_alternative(g, cell->codes[j]);
+            }
+            printf("\n");
+        }
+        printf(status == LL1_CHECK_OK ? "Grammar is LL(1)\n" : "Grammar is not LL(1)!\n");
+        if (conflicts_json && check == 2) {
+            FILE *out = strcmp(conflicts_json, "-") == 0 ? stdout : fopen(conflicts_json, "w");
+            if (!out) {
+                printf("Error opening file\n");
+                return 1;
+            }
+            write_conflict_report_json(out, g, &pm.suffix, &pm.conflicts);
+            if (out != stdout) fclose(out);
+        }
+        free_pass_manager(&pm);
+        return status;
+    }
+
+    // Export mode: transform and write the sets and table in a machine format
+    // to a file, "-" for stdout or "fd:N" for an open file descriptor
+    if (export_format >= 0) {
+        static Writer w;
+        FILE *out = NULL;
+        run_pass(&pm, &left_factoring_pass, NULL);
+        run_pass(&pm, &left_recursion_pass, NULL);
+        if (reduce) run_pass(&pm, &reduce_pass, NULL);
+        report_table_conflicts = 0;
+        require_analyses(&pm, ANALYSIS_TABLE);
+        fflush(stdout);
+        if (strcmp(export_to, "-") == 0) {
+            writer_init_fd(&w, 1);
+        } else if (strncmp(export_to, "fd:", 3) == 0) {
+            writer_init_fd(&w, atoi(export_to + 3));
+        } else {
+            out = fopen(export_to, "wb");
+            if (!out) {
+                printf("Error opening file\n");
+                return 1;
+            }
+            writer_init_file(&w, out);
+        }
+        export_analysis(&w, export_format, &pm);
+        writer_flush(&w);
+        if (out) fclose(out);
+        free_pass_manager(&pm);
+        return w.failed ? 1 : 0;
+    }
+
+    if (linked) {
+        // Each module was factored and freed of left recursion when it was loaded
+        printf("Linked Grammar (modules transformed separately):\n");
+        print_grammar(g);
+    } else {
+        printf("Original Grammar:\n");
+        print_grammar(g);
+
+        // Perform left factoring
+        run_pass(&pm, &left_factoring_pass, NULL);
+        printf("\nGrammar after Left Factoring:\n");
+        print_grammar(g);
+
+        // Remove left recursion
+        run_pass(&pm, &left_recursion_pass, NULL);
+        printf("\nGrammar after Left Recursion Removal:\n");
+        print_grammar(g);
+    }
+
+    // Drop useless symbols, unit productions and duplicate non-terminals
+    if (reduce) {
+        run_pass(&pm, &reduce_pass, NULL);
+        printf("\nGrammar after Reduction:\n");
+        print_grammar(g);
+    }
     
     // Compute FIRST sets
-    char first_sets[MAX_SYMBOLS][MAX_SYMBOLS][MAX_SYMBOL_LENGTH];
-    int first_count[MAX_SYMBOLS] = {0};
-    compute_first_sets(g_no_left_recursion, first_sets, first_count);
+    require_analyses(&pm, ANALYSIS_FIRST);
     
     // Print FIRST sets
     printf("\nFIRST Sets:\n");
-    for (int i = 0; i < g_no_left_recursion.non_terminal_count; i++) {
-        printf("FIRST(%s) = { ", g_no_left_recursion.non_terminals[i]);
-        for (int j = 0; j < first_count[i]; j++) {
-            printf("%s ", first_sets[i][j]);
-            if (j < first_count[i] - 1) printf(", ");
-        }
-        printf("}\n");
-    }
-    
+    print_symbol_sets(g, "FIRST", pm.first_sets, pm.first_count);
+
     // Compute FOLLOW sets
-    char follow_sets[MAX_SYMBOLS][MAX_SYMBOLS][MAX_SYMBOL_LENGTH];
-    int follow_count[MAX_SYMBOLS] = {0};
-    compute_follow_sets(g_no_left_recursion, first_sets, first_count, follow_sets, follow_count);
+    require_analyses(&pm, ANALYSIS_FOLLOW);
     
     // Print FOLLOW sets
     printf("\nFOLLOW Sets:\n");
-    for (int i = 0; i < g_no_left_recursion.non_terminal_count; i++) {
-        printf("FOLLOW(%s) = { ", g_no_left_recursion.non_terminals[i]);
-        for (int j = 0; j < follow_count[i]; j++) {
-            printf("%s ", follow_sets[i][j]);
-            if (j < follow_count[i] - 1) printf(", ");
-        }
-        printf("}\n");
-    }
+    print_symbol_sets(g, "FOLLOW", pm.follow_sets, pm.follow_count);
     
     // Construct LL(1) parsing table
-    int parsing_table[MAX_SYMBOLS][MAX_SYMBOLS];
-    memset(parsing_table, -1, sizeof(parsing_table));
-    construct_parsing_table(g_no_left_recursion, first_sets, first_count, follow_sets, follow_count, parsing_table);
-    print_parsing_table(g_no_left_recursion, parsing_table);
+    require_analyses(&pm, ANALYSIS_TABLE);
+    print_parsing_table(g, pm.parsing_table);
+
+    // Write the conflict analysis ("-" for stdout)
+    if (conflicts_json) {
+        FILE *out = strcmp(conflicts_json, "-") == 0 ? stdout : fopen(conflicts_json, "w");
+        if (!out) {
+            printf("Error opening file\n");
+            return 1;
+        }
+        write_conflict_report_json(out, g, &pm.suffix, &pm.conflicts);
+        if (out != stdout) fclose(out);
+    }
+
+    // Marked operator levels are parsed by precedence climbing
+    if (operators.count) build_pratt_table(g, &operators, &pratt);
+    if (profile_file) load_parse_profile(g, profile_file, &profile);
+
+    // Compress the table and run the parser on an input file
+    if (compress || parse_file) {
+        CompressedTable table;
+        build_compressed_table(g, &pm.ig, pm.parsing_table, 1, &table);
+        print_compression_report(g, &table);
+        ProfiledTable profiled;
+        if (profile_file) {
+            build_profiled_table(&pm.ig, &table, &profile, &profiled);
+            print_layout_report(g, &table, &profiled, &profile);
+        }
+        if (parse_file) {
+            int count;
+            int *tokens = read_token_file(g, parse_file, &count);
+            if (pm.conflicts.cell_count > 0) {
+                // Conflicting cells are parsed by the GLL engine
+                static GllParser gll;
+                if (profile_file) printf("\nThe profiled layout is not used with a conflicting table\n");
+                gll_init(&gll, &pm.ig, &pm.suffix, &pm.conflicts, &table, gll_limit);
+                int result = gll_parse(&gll, tokens, count);
+                if (result == GLL_LIMIT_EXCEEDED) {
+                    printf("\nInput needs more than %zu MB of GLL memory\n", gll_limit >> 20);
+                } else if (result >= 0) {
+                    printf("\nInput accepted (%d GLL regions, %ld descriptors, %ld SPPF nodes%s)\n",
+                           gll.regions, gll.descriptor_total, gll.sppf_total, gll.ambiguous ? ", ambiguous" : "");
+                } else {
+                    printf("\nInput rejected at token %d\n", -result);
+                }
+                if (sppf_file) {
+                    static Writer w;
+                    FILE *out = fopen(sppf_file, "w");
+                    if (!out) {
+                        printf("Error opening file\n");
+                        return 1;
+                    }
+                    writer_init_file(&w, out);
+                    write_sppf_dot(&w, g, &gll);
+                    writer_flush(&w);
+                    fclose(out);
+                }
+                free_gll_parser(&gll);
+            } else if (operators.count) {
+                static OperatorOrder applied;
+                if (profile_file) printf("\nThe profiled layout is not used with operator levels\n");
+                int result = pratt_parse(&pm.ig, &table, &pratt, tokens, count, &applied);
+                if (result >= 0) {
+                    printf("\nInput accepted (%d operators by precedence climbing)\n", applied.count);
+                } else {
+                    printf("\nInput rejected at token %d\n", -result);
+                }
+                free(applied.positions);
+            } else {
+                int result = profile_file ? profiled_parse(&profiled, tokens, count)
+                                          : ll1_parse(&pm.ig, &table, tokens, count, NULL);
+                if (result >= 0) {
+                    printf("\nInput accepted\n");
+                } else {
+                    printf("\nInput rejected at token %d\n", -result);
+                }
+            }
+            // Add the cells this input uses to the profile file
+            if (profile_out) {
+                static ParseProfile recorded;
+                FILE *existing = fopen(profile_out, "r");
+                if (existing) {
+                    fclose(existing);
+                    load_parse_profile(g, profile_out, &recorded);
+                }
+                ll1_parse(&pm.ig, &table, tokens, count, &recorded);
+                save_parse_profile(g, profile_out, &recorded);
+                printf("Profile saved to %s\n", profile_out);
+            }
+            // Apply edits to the parsed input, reparsing only what they affect
+            if (edit_file && pm.conflicts.cell_count > 0) {
+                printf("\nIncremental reparsing needs a conflict-free table\n");
+            } else if (edit_file) {
+                static IncrementalParse doc;
+                incremental_parse(&doc, &pm.ig, &table, tokens, count, INCREMENTAL_SEGMENT);
+                apply_edit_file(g, &doc, edit_file);
+                free_incremental_parse(&doc);
+            }
+            free(tokens);
+        }
+        if (profile_file) free_profiled_table(&profiled);
+        free_compressed_table(&table);
+    }
+    if (bench_file) {
+        int count;
+        int *tokens = read_token_file(g, bench_file, &count);
+        benchmark_parser(g, &pm.ig, &pm.suffix, &pm.conflicts, pm.parsing_table, operators.count ? &pratt : NULL,
+                         profile_file ? &profile : NULL, tokens, count, bench_iterations);
+        free(tokens);
+    }
 
+    // Resolve conflicting cells with k tokens of lookahead
+    if (lookahead_k > 1) {
+        static LLkAnalysis llk;
+        compute_llk_analysis(&pm.ig, lookahead_k, &llk);
+        print_llk_report(g, &llk);
+        free_llk_analysis(&llk);
+    }
 
     // Print parsing table
     // printf("\nLL(1) Parsing Table:\n");
@@ -148,24 +932,52 @@ int main() {
     //     }
     //     printf("\n");
     // }
-    
+
+    free_pass_manager(&pm);
     return 0;
 }
+#endif
+
+// Set by callers that want to recover from capacity errors instead of exiting.
+jmp_buf *capacity_trap = NULL;
+const char *capacity_what = NULL;
+
+// Reports a grammar that does not fit in the MAX_* arrays.
+void capacity_error(const char *what) {
+    capacity_what = what;
+    if (capacity_trap) {
+        longjmp(*capacity_trap, 1);
+    }
+    printf("Error: grammar exceeds the maximum number of %s\n", what);
+    exit(1);
+}
+
+static void check_symbol_length(const char *symbol) {
+    if (strlen(symbol) >= MAX_SYMBOL_LENGTH) capacity_error("characters in a symbol");
+}
 
 Grammar read_grammar_from_file(const char* filename) {
-    Grammar g;
-    g.prod_count = 0;
-    g.non_terminal_count = 0;
-    g.terminal_count = 0;
-    
     FILE* file = fopen(filename, "r");
     if (!file) {
         printf("Error opening file\n");
         exit(1);
     }
+    Grammar g = read_grammar(file);
+    fclose(file);
+    return g;
+}
+
+Grammar read_grammar(FILE *file) {
+    Grammar g;
+    g.prod_count = 0;
+    g.non_terminal_count = 0;
+    g.terminal_count = 0;
     
     char line[256];
     while (fgets(line, sizeof(line), file)) {
+        // A line without its newline did not fit in the buffer.
+        if (!strchr(line, '\n') && !feof(file)) capacity_error("characters in a line");
+
         // Remove newline and skip empty lines
         line[strcspn(line, "\n")] = '\0';
         if (strlen(line) == 0) continue;
@@ -188,6 +1000,8 @@ Grammar read_grammar_from_file(const char* filename) {
         }
         
         // Set production LHS and update non-terminals list
+        if (g.prod_count >= MAX_PRODUCTIONS) capacity_error("productions");
+        check_symbol_length(lhs);
         strcpy(g.productions[g.prod_count].lhs, lhs);
         int found = 0;
         for (int i = 0; i < g.non_terminal_count; i++) {
@@ -197,6 +1011,7 @@ Grammar read_grammar_from_file(const char* filename) {
             }
         }
         if (!found) {
+            if (g.non_terminal_count >= MAX_SYMBOLS) capacity_error("non-terminals");
             strcpy(g.non_terminals[g.non_terminal_count], lhs);
             g.non_terminal_count++;
         }
@@ -230,12 +1045,15 @@ Grammar read_grammar_from_file(const char* filename) {
             }
             
             // Tokenize this alternative by spaces to get individual symbols
+            if (g.productions[g.prod_count].rhs_count >= MAX_RHS) capacity_error("alternatives");
             int symbol_index = 0;
             char temp[256];
             strcpy(temp, alt);
             char *token = strtok(temp, " ");
             while (token) {
                 // Copy the token into the production alternative
+                if (symbol_index >= MAX_SYMBOL_LENGTH) capacity_error("symbols in an alternative");
+                check_symbol_length(token);
                 strcpy(g.productions[g.prod_count].rhs[g.productions[g.prod_count].rhs_count][symbol_index], token);
                 // Update non-terminals/terminals lists
                 if (isupper(token[0])) {
@@ -247,6 +1065,7 @@ Grammar read_grammar_from_file(const char* filename) {
                         }
                     }
                     if (!found) {
+                        if (g.non_terminal_count >= MAX_SYMBOLS) capacity_error("non-terminals");
                         strcpy(g.non_terminals[g.non_terminal_count], token);
                         g.non_terminal_count++;
                     }
@@ -260,6 +1079,8 @@ Grammar read_grammar_from_file(const char* filename) {
                             }
                         }
                         if (!found) {
+                            // Leave room for epsilon and '$' in the FIRST/FOLLOW sets.
+                            if (g.terminal_count >= MAX_SYMBOLS - 2) capacity_error("terminals");
                             strcpy(g.terminals[g.terminal_count], token);
                             g.terminal_count++;
                         }
@@ -281,7 +1102,6 @@ Grammar read_grammar_from_file(const char* filename) {
         g.prod_count++;
     }
     
-    fclose(file);
     return g;
 }
 
@@ -325,6 +1145,19 @@ void left_factor_production(Grammar *g, Production *p) {
         // Start a new group with alternative i.
         int groupCount = 1;
         processed[i] = 1;
+
+        // Repeated epsilon alternatives collapse into one; factoring them would
+        // only create A' -> epsilon | epsilon again, forever.
+        if (strcmp(firstToken, "epsilon") == 0 && p->symbols_in_rhs[i] == 1) {
+            for (int j = i + 1; j < p->rhs_count; j++) {
+                if (p->symbols_in_rhs[j] == 1 && strcmp(p->rhs[j][0], "epsilon") == 0)
+                    processed[j] = 1;
+            }
+            strcpy(newProd.rhs[newProd.rhs_count][0], "epsilon");
+            newProd.symbols_in_rhs[newProd.rhs_count] = 1;
+            newProd.rhs_count++;
+            continue;
+        }
         
         // Temporary storage for suffixes in the group.
         // Each suffix is a sequence of tokens from index 1 onward.
@@ -355,6 +1188,7 @@ void left_factor_production(Grammar *g, Production *p) {
             // Factor this group out.
             // Create a new non-terminal for the factored suffix.
             char new_nt[MAX_SYMBOL_LENGTH];
+            if (strlen(p->lhs) + 1 >= MAX_SYMBOL_LENGTH) capacity_error("characters in a symbol");
             sprintf(new_nt, "%s'", p->lhs);
             // Ensure uniqueness by appending additional primes if needed.
             int unique = 0;
@@ -362,6 +1196,7 @@ void left_factor_production(Grammar *g, Production *p) {
                 unique = 1;
                 for (int x = 0; x < g->non_terminal_count; x++) {
                     if (strcmp(g->non_terminals[x], new_nt) == 0) {
+                        if (strlen(new_nt) + 1 >= MAX_SYMBOL_LENGTH) capacity_error("characters in a symbol");
                         strcat(new_nt, "'");
                         unique = 0;
                         break;
@@ -369,6 +1204,7 @@ void left_factor_production(Grammar *g, Production *p) {
                 }
             }
             // Add new_nt to grammar's non-terminals.
+            if (g->non_terminal_count >= MAX_SYMBOLS) capacity_error("non-terminals");
             strcpy(g->non_terminals[g->non_terminal_count++], new_nt);
             
             // In the original production, add one alternative: firstToken followed by new_nt.
@@ -398,6 +1234,7 @@ void left_factor_production(Grammar *g, Production *p) {
                 newProd2.rhs_count++;
             }
             // Add newProd2 to grammar.
+            if (g->prod_count >= MAX_PRODUCTIONS) capacity_error("productions");
             g->productions[g->prod_count++] = newProd2;
         } else {
             // Only one alternative had this first token: copy it unchanged.
@@ -417,43 +1254,83 @@ void left_factor_production(Grammar *g, Production *p) {
     /*
 * The main left_factor function that processes each production by factoring subsets of alternatives.
 */
-Grammar left_factoring(Grammar g) {
-    int changed = 1;
+int left_factoring_in_place(Grammar *g) {
+    int changed = 1, any = 0;
     while (changed) {
         changed = 0;
-        for (int i = 0; i < g.prod_count; i++) {
-            int oldCount = g.productions[i].rhs_count;
-            left_factor_production(&g, &g.productions[i]);
-            if (g.productions[i].rhs_count != oldCount)
-                changed = 1;
+        for (int i = 0; i < g->prod_count; i++) {
+            int oldCount = g->productions[i].rhs_count;
+            left_factor_production(g, &g->productions[i]);
+            if (g->productions[i].rhs_count != oldCount)
+                changed = any = 1;
         }
     }
-    return g;
+    return any;
+}
 
+Grammar left_factoring(Grammar g) {
+    left_factoring_in_place(&g);
+    return g;
 }
 
 
 // Revised remove_left_recursion that handles productions with no non-left-recursive alternative.
-Grammar remove_left_recursion(Grammar g) {
-    Grammar result;
-    result.prod_count = 0;
-    result.non_terminal_count = g.non_terminal_count;
-    result.terminal_count = g.terminal_count;
-    strcpy(result.start_symbol, g.start_symbol);
-    
-    // Copy existing non-terminals and terminals.
-    for (int i = 0; i < g.non_terminal_count; i++) {
-        strcpy(result.non_terminals[i], g.non_terminals[i]);
-    }
-    for (int i = 0; i < g.terminal_count; i++) {
-        strcpy(result.terminals[i], g.terminals[i]);
+// Works in place: a forward pass names the new non-terminals (in the order they
+// are added), then productions are rewritten from the last one down, each moving
+// to its final index so no production is overwritten before it has been read.
+// Returns 1 if any left recursion was removed.
+int remove_left_recursion_in_place(Grammar *g) {
+    char new_names[MAX_PRODUCTIONS][MAX_SYMBOL_LENGTH];
+    int recursive[MAX_PRODUCTIONS];
+    int added = 0;
+
+    for (int i = 0; i < g->prod_count; i++) {
+        Production *prod = &g->productions[i];
+        int beta_count = 0;
+        recursive[i] = 0;
+        for (int j = 0; j < prod->rhs_count; j++) {
+            if (prod->symbols_in_rhs[j] > 0 && strcmp(prod->rhs[j][0], prod->lhs) == 0) beta_count++;
+        }
+        if (beta_count == 0) continue;
+        if (beta_count + 1 > MAX_RHS) capacity_error("alternatives");
+        // The other alternatives of a rewritten production get the new non-terminal appended.
+        for (int j = 0; j < prod->rhs_count; j++) {
+            if (prod->symbols_in_rhs[j] > 0 && strcmp(prod->rhs[j][0], prod->lhs) == 0) continue;
+            if (prod->symbols_in_rhs[j] + 1 > MAX_SYMBOL_LENGTH) capacity_error("symbols in an alternative");
+        }
+        recursive[i] = 1;
+
+        // Generate a new non-terminal name for the left-recursive part.
+        char *new_nt = new_names[i];
+        if (strlen(prod->lhs) + 1 >= MAX_SYMBOL_LENGTH) capacity_error("characters in a symbol");
+        sprintf(new_nt, "%s'", prod->lhs);
+        // Ensure uniqueness: if new_nt is already present, append another prime.
+        while (get_non_terminal_index(g, new_nt) != -1) {
+            if (strlen(new_nt) + 1 >= MAX_SYMBOL_LENGTH) capacity_error("characters in a symbol");
+            strcat(new_nt, "'");
+        }
+        if (g->non_terminal_count >= MAX_SYMBOLS) capacity_error("non-terminals");
+        strcpy(g->non_terminals[g->non_terminal_count], new_nt);
+        g->non_terminal_count++;
+        added++;
     }
-    
-    // Process each production (assumed one production per non-terminal).
-    for (int i = 0; i < g.prod_count; i++) {
-        Production prod = g.productions[i];
+    if (added == 0) return 0;
+    // Each left-recursive production is followed by the one for its new non-terminal.
+    if (g->prod_count + added > MAX_PRODUCTIONS) capacity_error("productions");
+
+    int dest = g->prod_count + added;
+    for (int i = g->prod_count - 1; i >= 0; i--) {
+        if (!recursive[i]) {
+            // No left recursion: move the production as is.
+            dest--;
+            if (dest != i) g->productions[dest] = g->productions[i];
+            continue;
+        }
+
+        Production *prod = &g->productions[i];
         char A[MAX_SYMBOL_LENGTH];
-        strcpy(A, prod.lhs);
+        strcpy(A, prod->lhs);
+        char *new_nt = new_names[i];
         
         // Temporary storage for alternatives:
         // alpha: non-left-recursive alternatives.
@@ -467,129 +1344,113 @@ Grammar remove_left_recursion(Grammar g) {
         int beta_symbol_count[MAX_RHS] = {0};
         
         // Separate alternatives.
-        for (int j = 0; j < prod.rhs_count; j++) {
-            if (prod.symbols_in_rhs[j] > 0 && strcmp(prod.rhs[j][0], A) == 0) {
+        for (int j = 0; j < prod->rhs_count; j++) {
+            if (prod->symbols_in_rhs[j] > 0 && strcmp(prod->rhs[j][0], A) == 0) {
                 // Left recursive alternative: store its suffix (tokens after A).
-                beta_symbol_count[beta_count] = prod.symbols_in_rhs[j] - 1;
-                for (int k = 1; k < prod.symbols_in_rhs[j]; k++) {
-                    strcpy(beta[beta_count][k - 1], prod.rhs[j][k]);
+                beta_symbol_count[beta_count] = prod->symbols_in_rhs[j] - 1;
+                for (int k = 1; k < prod->symbols_in_rhs[j]; k++) {
+                    strcpy(beta[beta_count][k - 1], prod->rhs[j][k]);
                 }
                 beta_count++;
             } else {
                 // Non-left-recursive alternative.
-                alpha_symbol_count[alpha_count] = prod.symbols_in_rhs[j];
-                for (int k = 0; k < prod.symbols_in_rhs[j]; k++) {
-                    strcpy(alpha[alpha_count][k], prod.rhs[j][k]);
+                alpha_symbol_count[alpha_count] = prod->symbols_in_rhs[j];
+                for (int k = 0; k < prod->symbols_in_rhs[j]; k++) {
+                    strcpy(alpha[alpha_count][k], prod->rhs[j][k]);
                 }
                 alpha_count++;
             }
         }
+
+        // prod may be overwritten from here on; dest >= i.
+        dest -= 2;
+        Production *newProd = &g->productions[dest];
+        Production *newProd2 = &g->productions[dest + 1];
+        strcpy(newProd->lhs, A);
+        newProd->rhs_count = 0;
         
-        if (beta_count > 0) {
-            // Left recursion exists for A.
-            // Generate a new non-terminal name for the left-recursive part.
-            char new_nt[MAX_SYMBOL_LENGTH];
-            sprintf(new_nt, "%s'", A);
-            // Ensure uniqueness: if new_nt is already present, append another prime.
-            while(get_non_terminal_index(result, new_nt) != -1) {
-                strcat(new_nt, "'");
-            }
-            // Add new_nt to result's non-terminals.
-            strcpy(result.non_terminals[result.non_terminal_count], new_nt);
-            result.non_terminal_count++;
-            
-            // CASE 1: If at least one non-left-recursive alternative exists.
-            if (alpha_count > 0) {
-                Production newProd;
-                strcpy(newProd.lhs, A);
-                newProd.rhs_count = 0;
-                for (int j = 0; j < alpha_count; j++) {
-                    int count = alpha_symbol_count[j];
-                    for (int k = 0; k < count; k++) {
-                        strcpy(newProd.rhs[newProd.rhs_count][k], alpha[j][k]);
-                    }
-                    // Append new_nt at the end.
-                    strcpy(newProd.rhs[newProd.rhs_count][count], new_nt);
-                    newProd.symbols_in_rhs[newProd.rhs_count] = count + 1;
-                    newProd.rhs_count++;
-                }
-                result.productions[result.prod_count] = newProd;
-                result.prod_count++;
-            } else {
-                // CASE 2: No non-left-recursive alternative.
-                Production newProd;
-                strcpy(newProd.lhs, A);
-                newProd.rhs_count = 1;
-                int count = beta_symbol_count[0]; // Use the first beta alternative.
+        // CASE 1: If at least one non-left-recursive alternative exists.
+        if (alpha_count > 0) {
+            for (int j = 0; j < alpha_count; j++) {
+                int count = alpha_symbol_count[j];
+                // An epsilon alternative becomes just new_nt.
+                if (count == 1 && strcmp(alpha[j][0], "epsilon") == 0)
+                    count = 0;
                 for (int k = 0; k < count; k++) {
-                    strcpy(newProd.rhs[0][k], beta[0][k]);
+                    strcpy(newProd->rhs[newProd->rhs_count][k], alpha[j][k]);
                 }
-                // Append new_nt.
-                strcpy(newProd.rhs[0][count], new_nt);
-                newProd.symbols_in_rhs[0] = count + 1;
-                result.productions[result.prod_count] = newProd;
-                result.prod_count++;
-            }
-            
-            // Create production for the new non-terminal new_nt.
-            Production newProd2;
-            strcpy(newProd2.lhs, new_nt);
-            newProd2.rhs_count = 0;
-            for (int j = 0; j < beta_count; j++) {
-                int count = beta_symbol_count[j];
-                for (int k = 0; k < count; k++) {
-                    strcpy(newProd2.rhs[newProd2.rhs_count][k], beta[j][k]);
-                }
-                // Append new_nt at the end for recursion.
-                strcpy(newProd2.rhs[newProd2.rhs_count][count], new_nt);
-                newProd2.symbols_in_rhs[newProd2.rhs_count] = count + 1;
-                newProd2.rhs_count++;
+                // Append new_nt at the end.
+                strcpy(newProd->rhs[newProd->rhs_count][count], new_nt);
+                newProd->symbols_in_rhs[newProd->rhs_count] = count + 1;
+                newProd->rhs_count++;
             }
-            // Add an alternative for epsilon.
-            strcpy(newProd2.rhs[newProd2.rhs_count][0], "epsilon");
-            newProd2.symbols_in_rhs[newProd2.rhs_count] = 1;
-            newProd2.rhs_count++;
-            
-            result.productions[result.prod_count] = newProd2;
-            result.prod_count++;
         } else {
-            // No left recursion: copy the production as is.
-            result.productions[result.prod_count] = prod;
-            result.prod_count++;
+            // CASE 2: No non-left-recursive alternative.
+            newProd->rhs_count = 1;
+            int count = beta_symbol_count[0]; // Use the first beta alternative.
+            for (int k = 0; k < count; k++) {
+                strcpy(newProd->rhs[0][k], beta[0][k]);
+            }
+            // Append new_nt.
+            strcpy(newProd->rhs[0][count], new_nt);
+            newProd->symbols_in_rhs[0] = count + 1;
+        }
+        
+        // Create production for the new non-terminal new_nt.
+        strcpy(newProd2->lhs, new_nt);
+        newProd2->rhs_count = 0;
+        for (int j = 0; j < beta_count; j++) {
+            int count = beta_symbol_count[j];
+            for (int k = 0; k < count; k++) {
+                strcpy(newProd2->rhs[newProd2->rhs_count][k], beta[j][k]);
+            }
+            // Append new_nt at the end for recursion.
+            strcpy(newProd2->rhs[newProd2->rhs_count][count], new_nt);
+            newProd2->symbols_in_rhs[newProd2->rhs_count] = count + 1;
+            newProd2->rhs_count++;
         }
+        // Add an alternative for epsilon.
+        strcpy(newProd2->rhs[newProd2->rhs_count][0], "epsilon");
+        newProd2->symbols_in_rhs[newProd2->rhs_count] = 1;
+        newProd2->rhs_count++;
     }
-    
-    return result;
+    g->prod_count += added;
+    return 1;
+}
+
+Grammar remove_left_recursion(Grammar g) {
+    remove_left_recursion_in_place(&g);
+    return g;
 }
 
 
-void compute_first_sets(Grammar g, char first_sets[MAX_SYMBOLS][MAX_SYMBOLS][MAX_SYMBOL_LENGTH], int first_count[MAX_SYMBOLS]) {
+void compute_first_sets(Grammar *g, char first_sets[MAX_SYMBOLS][MAX_SYMBOLS][MAX_SYMBOL_LENGTH], int first_count[MAX_SYMBOLS]) {
     int i, j, k, t;
     // Initialize FIRST sets for all non-terminals to empty.
-    for (i = 0; i < g.non_terminal_count; i++) {
+    for (i = 0; i < g->non_terminal_count; i++) {
         first_count[i] = 0;
     }
     
     // For terminals, we store their FIRST set in the indices after non-terminals (if needed)
-    for (i = 0; i < g.terminal_count; i++) {
-        strcpy(first_sets[g.non_terminal_count + i][0], g.terminals[i]);
-        first_count[g.non_terminal_count + i] = 1;
+    for (i = 0; i < g->terminal_count && g->non_terminal_count + i < MAX_SYMBOLS; i++) {
+        strcpy(first_sets[g->non_terminal_count + i][0], g->terminals[i]);
+        first_count[g->non_terminal_count + i] = 1;
     }
     
     int changed = 1;
     while(changed) {
         changed = 0;
         // Process each production in the grammar.
-        for (i = 0; i < g.prod_count; i++) {
-            Production p = g.productions[i];
+        for (i = 0; i < g->prod_count; i++) {
+            const Production *p = &g->productions[i];
             // Get the index for the LHS non-terminal.
-            int lhs_index = get_non_terminal_index(g, p.lhs);
+            int lhs_index = get_non_terminal_index(g, p->lhs);
             if (lhs_index == -1) continue;
             
             // Process each alternative for this production.
-            for (j = 0; j < p.rhs_count; j++) {
+            for (j = 0; j < p->rhs_count; j++) {
                 // If the alternative is exactly "epsilon", add it.
-                if (p.symbols_in_rhs[j] == 1 && strcmp(p.rhs[j][0], "epsilon") == 0) {
+                if (p->symbols_in_rhs[j] == 1 && strcmp(p->rhs[j][0], "epsilon") == 0) {
                     int exists = 0;
                     for (t = 0; t < first_count[lhs_index]; t++) {
                         if (strcmp(first_sets[lhs_index][t], "epsilon") == 0) {
@@ -606,8 +1467,8 @@ void compute_first_sets(Grammar g, char first_sets[MAX_SYMBOLS][MAX_SYMBOLS][MAX
                 
                 // Process the symbols in the alternative left-to-right.
                 int allCanBeEpsilon = 1;
-                for (k = 0; k < p.symbols_in_rhs[j]; k++) {
-                    char *symbol = p.rhs[j][k];
+                for (k = 0; k < p->symbols_in_rhs[j]; k++) {
+                    const char *symbol = p->rhs[j][k];
                     // Check if the symbol is terminal or non-terminal by using our grammar.
                     if (get_non_terminal_index(g, symbol) == -1) {
                         // symbol is a terminal; add it and stop.
@@ -676,243 +1537,278 @@ void compute_first_sets(Grammar g, char first_sets[MAX_SYMBOLS][MAX_SYMBOLS][MAX
     }
 }
 
-void compute_follow_sets(Grammar g, char first_sets[MAX_SYMBOLS][MAX_SYMBOLS][MAX_SYMBOL_LENGTH], 
-                           int first_count[MAX_SYMBOLS],
-                           char follow_sets[MAX_SYMBOLS][MAX_SYMBOLS][MAX_SYMBOL_LENGTH], 
-                           int follow_count[MAX_SYMBOLS]) {
-    int i, j, k, t, u, v;
-    
-    // Initialize FOLLOW sets for all non-terminals to empty.
-    for (i = 0; i < g.non_terminal_count; i++) {
-        follow_count[i] = 0;
+/*
+   Suffix analysis: for every alternative A -> X1 ... Xn, one right-to-left pass
+   computes FIRST(Xi ... Xn) and whether it is nullable for every i, stored as
+   terminal bitsets. FOLLOW computation, table construction and the conflict
+   report read these instead of rescanning the tail of each alternative.
+*/
+void compute_suffix_sets(Grammar *g, IndexedGrammar *ig,
+                         char first_sets[MAX_SYMBOLS][MAX_SYMBOLS][MAX_SYMBOL_LENGTH], int first_count[MAX_SYMBOLS],
+                         SuffixSets *s)
+{
+    s->ig = ig;
+    memset(s->first, 0, sizeof(s->first));
+    memset(s->nullable, 0, sizeof(s->nullable));
+    for (int i = 0; i < ig->non_terminal_count; i++) {
+        for (int j = 0; j < first_count[i]; j++) {
+            if (strcmp(first_sets[i][j], "epsilon") == 0) {
+                s->nullable[i] = 1;
+                continue;
+            }
+            int code = get_symbol_code(g, first_sets[i][j]);
+            if (code != -1 && IS_TERMINAL_CODE(code)) term_set_add(&s->first[i], code - MAX_SYMBOLS);
+        }
     }
-    
-    // Add '$' to FOLLOW of the start symbol.
-    int startIndex = get_non_terminal_index(g, g.start_symbol);
-    if (startIndex != -1) {
-        strcpy(follow_sets[startIndex][follow_count[startIndex]++], "$");
+
+    int total = 0;
+    for (int a = 0; a < ig->alt_count; a++) {
+        s->suffix_start[a] = total;
+        total += ig->alts[a].length + 1;
     }
-    
-    int changed = 1;
-    while (changed) {
-        changed = 0;
-        // For every production A -> X1 X2 ... Xn.
-        for (i = 0; i < g.prod_count; i++) {
-            Production p = g.productions[i];
-            int A_index = get_non_terminal_index(g, p.lhs);
-            if (A_index == -1) continue;
-            // For each alternative of the production.
-            for (j = 0; j < p.rhs_count; j++) {
-                // For each symbol X in the alternative.
-                for (k = 0; k < p.symbols_in_rhs[j]; k++) {
-                    char *X = p.rhs[j][k];
-                    int X_index = get_non_terminal_index(g, X);
-                    if (X_index == -1) continue; // X is terminal, so skip.
-                    
-                    // Process the tail: symbols after X in the alternative.
-                    int tail_can_be_epsilon = 1; // Assume tail derives ε until proven otherwise.
-                    for (t = k + 1; t < p.symbols_in_rhs[j]; t++) {
-                        char *Y = p.rhs[j][t];
-                        // Check if Y is terminal or non-terminal.
-                        if (get_non_terminal_index(g, Y) == -1) {
-                            // Y is terminal; add Y to FOLLOW(X) if not already present.
-                            int exists = 0;
-                            for (u = 0; u < follow_count[X_index]; u++) {
-                                if (strcmp(follow_sets[X_index][u], Y) == 0) {
-                                    exists = 1;
-                                    break;
-                                }
-                            }
-                            if (!exists) {
-                                strcpy(follow_sets[X_index][follow_count[X_index]++], Y);
-                                changed = 1;
-                            }
-                            tail_can_be_epsilon = 0; // Terminal cannot produce ε.
-                            break;  // Stop processing further symbols in tail.
-                        } else {
-                            // Y is non-terminal.
-                            int Y_index = get_non_terminal_index(g, Y);
-                            // Add FIRST(Y) (excluding ε) to FOLLOW(X).
-                            for (u = 0; u < first_count[Y_index]; u++) {
-                                if (strcmp(first_sets[Y_index][u], "epsilon") == 0)
-                                    continue;
-                                int exists = 0;
-                                for (v = 0; v < follow_count[X_index]; v++) {
-                                    if (strcmp(follow_sets[X_index][v], first_sets[Y_index][u]) == 0) {
-                                        exists = 1;
-                                        break;
-                                    }
-                                }
-                                if (!exists) {
-                                    strcpy(follow_sets[X_index][follow_count[X_index]++], first_sets[Y_index][u]);
-                                    changed = 1;
-                                }
-                            }
-                            // Check if FIRST(Y) contains ε.
-                            int Y_has_epsilon = 0;
-                            for (u = 0; u < first_count[Y_index]; u++) {
-                                if (strcmp(first_sets[Y_index][u], "epsilon") == 0) {
-                                    Y_has_epsilon = 1;
-                                    break;
-                                }
-                            }
-                            if (!Y_has_epsilon) {
-                                tail_can_be_epsilon = 0;
-                                break; // Stop processing tail.
-                            }
-                        }
-                    } // End processing tail.
-                    
-                    // If the tail (or no tail) can derive ε, add FOLLOW(A) to FOLLOW(X).
-                    if (tail_can_be_epsilon) {
-                        for (u = 0; u < follow_count[A_index]; u++) {
-                            int exists = 0;
-                            for (v = 0; v < follow_count[X_index]; v++) {
-                                if (strcmp(follow_sets[X_index][v], follow_sets[A_index][u]) == 0) {
-                                    exists = 1;
-                                    break;
-                                }
-                            }
-                            if (!exists) {
-                                strcpy(follow_sets[X_index][follow_count[X_index]++], follow_sets[A_index][u]);
-                                changed = 1;
-                            }
-                        }
-                    }
-                } 
-            } 
+    if (total > s->suffix_capacity) {
+        s->suffix_capacity = total;
+        s->suffix_first = checked_realloc(s->suffix_first, total * sizeof(TermSet));
+        s->suffix_nullable = checked_realloc(s->suffix_nullable, total);
+    }
+
+    for (int a = 0; a < ig->alt_count; a++) {
+        IndexedAlternative *alt = &ig->alts[a];
+        TermSet *first = &s->suffix_first[s->suffix_start[a]];
+        unsigned char *nullable = &s->suffix_nullable[s->suffix_start[a]];
+        memset(&first[alt->length], 0, sizeof(TermSet));
+        nullable[alt->length] = 1;
+        for (int i = alt->length - 1; i >= 0; i--) {
+            int sym = alt->symbols[i];
+            if (IS_TERMINAL_CODE(sym)) {
+                memset(&first[i], 0, sizeof(TermSet));
+                term_set_add(&first[i], sym - MAX_SYMBOLS);
+                nullable[i] = 0;
+            } else if (s->nullable[sym]) {
+                first[i] = s->first[sym];
+                term_set_union(&first[i], &first[i + 1]);
+                nullable[i] = nullable[i + 1];
+            } else {
+                first[i] = s->first[sym];
+                nullable[i] = 0;
+            }
+        }
+    }
+}
+
+void free_suffix_sets(SuffixSets *s) {
+    free(s->suffix_first);
+    free(s->suffix_nullable);
+    s->suffix_first = NULL;
+    s->suffix_nullable = NULL;
+    s->suffix_capacity = 0;
+}
+
+void compute_follow_sets(Grammar *g, SuffixSets *suffix,
+                           char follow_sets[MAX_SYMBOLS][MAX_SYMBOLS][MAX_SYMBOL_LENGTH], 
+                           int follow_count[MAX_SYMBOLS]) {
+    static int edge_from[MAX_ALTERNATIVES * MAX_SYMBOL_LENGTH];
+    static int edge_to[MAX_ALTERNATIVES * MAX_SYMBOL_LENGTH];
+    IndexedGrammar *ig = suffix->ig;
+    int edge_count = 0;
+
+    memset(suffix->follow, 0, sizeof(suffix->follow));
+
+    // Add '$' to FOLLOW of the start symbol.
+    if (ig->start >= 0) {
+        term_set_add(&suffix->follow[ig->start], g->terminal_count);
+    }
+
+    // For A -> x X y, FIRST(y) goes into FOLLOW(X) once; if y is nullable,
+    // FOLLOW(A) flows into FOLLOW(X), which is resolved below.
+    for (int a = 0; a < ig->alt_count; a++) {
+        IndexedAlternative *alt = &ig->alts[a];
+        int base = suffix->suffix_start[a];
+        for (int k = 0; k < alt->length; k++) {
+            int X = alt->symbols[k];
+            if (IS_TERMINAL_CODE(X)) continue;
+            term_set_union(&suffix->follow[X], &suffix->suffix_first[base + k + 1]);
+            if (suffix->suffix_nullable[base + k + 1] && X != alt->lhs) {
+                edge_from[edge_count] = alt->lhs;
+                edge_to[edge_count] = X;
+                edge_count++;
+            }
+        }
+    }
+
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int e = 0; e < edge_count; e++) {
+            changed |= term_set_union(&suffix->follow[edge_to[e]], &suffix->follow[edge_from[e]]);
+        }
+    }
+
+    // String form of the sets, in column order.
+    for (int i = 0; i < g->non_terminal_count; i++) {
+        follow_count[i] = 0;
+        for (int col = 0; col <= g->terminal_count; col++) {
+            if (term_set_has(&suffix->follow[i], col)) {
+                strcpy(follow_sets[i][follow_count[i]++], column_name(g, col));
+            }
         }
-    } 
+    }
 }
 
 
 // We encode a table entry as: entry = prodIndex * 1000 + altIndex
 // (Assuming prodIndex and altIndex are less than 1000.)
 
-void construct_parsing_table(Grammar g,
-                             char first_sets[MAX_SYMBOLS][MAX_SYMBOLS][MAX_SYMBOL_LENGTH],
-                             int first_count[MAX_SYMBOLS],
-                             char follow_sets[MAX_SYMBOLS][MAX_SYMBOLS][MAX_SYMBOL_LENGTH],
-                             int follow_count[MAX_SYMBOLS],
-                             int parsing_table[MAX_SYMBOLS][MAX_SYMBOLS])
+// Records one more alternative for a conflicting cell.
+static void add_conflict_entry(ConflictReport *conflicts, int nt_index, int col, int code, int via_follow) {
+    ConflictCell *cell = NULL;
+    for (int i = 0; i < conflicts->cell_count; i++) {
+        if (conflicts->cells[i].nt_index == nt_index && conflicts->cells[i].col == col) {
+            cell = &conflicts->cells[i];
+            break;
+        }
+    }
+    if (!cell) {
+        if (conflicts->cell_count == conflicts->cell_capacity) {
+            conflicts->cell_capacity = conflicts->cell_capacity ? conflicts->cell_capacity * 2 : 16;
+            conflicts->cells = checked_realloc(conflicts->cells, conflicts->cell_capacity * sizeof(ConflictCell));
+        }
+        cell = &conflicts->cells[conflicts->cell_count++];
+        cell->nt_index = nt_index;
+        cell->col = col;
+        cell->count = 0;
+    }
+    for (int i = 0; i < cell->count; i++) {
+        if (cell->codes[i] == code) return;
+    }
+    if (cell->count < MAX_RHS) {
+        cell->codes[cell->count] = code;
+        cell->via_follow[cell->count] = via_follow;
+        cell->count++;
+    }
+}
+
+// Cleared by callers whose stdout carries machine-readable output.
+int report_table_conflicts = 1;
+
+// Places an alternative in a table cell. via_follow is 1 when the entry comes
+// from FOLLOW(lhs) because the alternative is nullable.
+static void set_table_entry(Grammar *g, int parsing_table[MAX_SYMBOLS][MAX_SYMBOLS],
+                            int entry_via_follow[MAX_SYMBOLS][MAX_SYMBOLS], ConflictReport *conflicts,
+                            int nt_index, int col, int code, int via_follow)
+{
+    int old = parsing_table[nt_index][col];
+    if (old == code) return;
+    if (old != -1) {
+        if (report_table_conflicts) {
+            printf("Conflict in parsing table at [%s, %s]\n",
+                   g->non_terminals[nt_index], column_name(g, col));
+            printf("Grammar is not LL(1)!\n");
+        }
+        if (conflicts) {
+            add_conflict_entry(conflicts, nt_index, col, old, entry_via_follow[nt_index][col]);
+            add_conflict_entry(conflicts, nt_index, col, code, via_follow);
+        }
+    }
+    parsing_table[nt_index][col] = code;
+    entry_via_follow[nt_index][col] = via_follow;
+}
+
+void construct_parsing_table(Grammar *g, SuffixSets *suffix,
+                             int parsing_table[MAX_SYMBOLS][MAX_SYMBOLS],
+                             ConflictReport *conflicts)
 {
+    static int entry_via_follow[MAX_SYMBOLS][MAX_SYMBOLS];
+    IndexedGrammar *ig = suffix->ig;
+    if (conflicts) conflicts->cell_count = 0;
+
     // Initialize table cells to -1 (empty).
-    for (int i = 0; i < g.non_terminal_count; i++) {
-        for (int j = 0; j < g.terminal_count + 1; j++) { // +1 for '$'
+    for (int i = 0; i < g->non_terminal_count; i++) {
+        for (int j = 0; j < g->terminal_count + 1; j++) { // +1 for '$'
             parsing_table[i][j] = -1;
         }
     }
 
-    // Process each production.
-    for (int prodIndex = 0; prodIndex < g.prod_count; prodIndex++) {
-        int nt_index = get_non_terminal_index(g, g.productions[prodIndex].lhs);
-        if (nt_index == -1) continue;
-
-        // For each alternative in this production.
-        for (int altIndex = 0; altIndex < g.productions[prodIndex].rhs_count; altIndex++) {
-            // If this alternative is exactly epsilon.
-            if (g.productions[prodIndex].symbols_in_rhs[altIndex] == 1 &&
-                strcmp(g.productions[prodIndex].rhs[altIndex][0], "epsilon") == 0)
-            {
-                // For each terminal in FOLLOW(LHS), place this production.
-                for (int f = 0; f < follow_count[nt_index]; f++) {
-                    int col = get_terminal_index(g, follow_sets[nt_index][f]);
-                    if (col == -1 && strcmp(follow_sets[nt_index][f], "$") == 0)
-                        col = g.terminal_count;
-                    if (col == -1)
-                        continue;
-                    if (parsing_table[nt_index][col] != -1) {
-                        printf("Conflict in parsing table at [%s, %s]\n",
-                               g.non_terminals[nt_index],
-                               (col == g.terminal_count) ? "$" : g.terminals[col]);
-                        printf("Grammar is not LL(1)!\n");
-                    }
-                    // Encode prodIndex and altIndex.
-                    parsing_table[nt_index][col] = prodIndex * 1000 + altIndex;
-                }
-            }
-            else {
-                // Compute FIRST for this alternative.
-                char first_of_alt[MAX_SYMBOLS][MAX_SYMBOL_LENGTH];
-                int count_first = 0;
-                int allNullable = 1;  // assume all symbols derive epsilon
-                int n = g.productions[prodIndex].symbols_in_rhs[altIndex];
-                for (int s = 0; s < n; s++) {
-                    char *sym = g.productions[prodIndex].rhs[altIndex][s];
-                    int sym_nt_index = get_non_terminal_index(g, sym);
-                    if (sym_nt_index == -1) {
-                        // terminal: add it and stop.
-                        add_to_set(first_of_alt, &count_first, sym);
-                        allNullable = 0;
-                        break;
-                    } else {
-                        // non-terminal: add its FIRST (except epsilon).
-                        for (int f = 0; f < first_count[sym_nt_index]; f++) {
-                            if (strcmp(first_sets[sym_nt_index][f], "epsilon") != 0)
-                                add_to_set(first_of_alt, &count_first, first_sets[sym_nt_index][f]);
-                        }
-                        if (!contains_epsilon(first_sets[sym_nt_index], first_count[sym_nt_index])) {
-                            allNullable = 0;
-                            break;
-                        }
-                    }
-                }
-                if (allNullable)
-                    add_to_set(first_of_alt, &count_first, "epsilon");
+    // Each alternative goes under FIRST(alt), and under FOLLOW(lhs) if alt is nullable.
+    for (int a = 0; a < ig->alt_count; a++) {
+        IndexedAlternative *alt = &ig->alts[a];
+        int base = suffix->suffix_start[a];
+        for (int col = 0; col <= g->terminal_count; col++) {
+            if (term_set_has(&suffix->suffix_first[base], col))
+                set_table_entry(g, parsing_table, entry_via_follow, conflicts, alt->lhs, col, alt->code, 0);
+        }
+        if (suffix->suffix_nullable[base]) {
+            for (int col = 0; col <= g->terminal_count; col++) {
+                if (term_set_has(&suffix->follow[alt->lhs], col))
+                    set_table_entry(g, parsing_table, entry_via_follow, conflicts, alt->lhs, col, alt->code, 1);
+            }
+        }
+    }
+}
 
-                // For every terminal in FIRST (except epsilon) fill table.
-                int hasEpsilon = 0;
-                for (int f = 0; f < count_first; f++) {
-                    if (strcmp(first_of_alt[f], "epsilon") == 0) {
-                        hasEpsilon = 1;
-                        continue;
-                    }
-                    int col = get_terminal_index(g, first_of_alt[f]);
-                    if (col == -1 && strcmp(first_of_alt[f], "$") == 0)
-                        col = g.terminal_count;
-                    if (col == -1)
-                        continue;
-                    if (parsing_table[nt_index][col] != -1) {
-                        printf("Conflict in parsing table at [%s, %s]\n",
-                               g.non_terminals[nt_index],
-                               (col == g.terminal_count) ? "$" : g.terminals[col]);
-                        printf("Grammar is not LL(1)!\n");
-                    }
-                    parsing_table[nt_index][col] = prodIndex * 1000 + altIndex;
-                }
-                // If epsilon is in FIRST, then for every terminal in FOLLOW(LHS) fill table.
-                if (hasEpsilon) {
-                    for (int f = 0; f < follow_count[nt_index]; f++) {
-                        int col = get_terminal_index(g, follow_sets[nt_index][f]);
-                        if (col == -1 && strcmp(follow_sets[nt_index][f], "$") == 0)
-                            col = g.terminal_count;
-                        if (col == -1)
-                            continue;
-                        if (parsing_table[nt_index][col] != -1) {
-                            printf("Conflict in parsing table at [%s, %s]\n",
-                                   g.non_terminals[nt_index],
-                                   (col == g.terminal_count) ? "$" : g.terminals[col]);
-                            printf("Grammar is not LL(1)!\n");
-                        }
-                        parsing_table[nt_index][col] = prodIndex * 1000 + altIndex;
-                    }
+// Decides whether the grammar is LL(1) without building the parsing table: the
+// predict set of every alternative (FIRST, plus FOLLOW(lhs) if it is nullable)
+// must be disjoint from those of the earlier alternatives of the same lhs.
+// Returns LL1_CHECK_CONFLICT at the first overlap when conflicts is NULL;
+// otherwise keeps going and records every conflicting cell, with the same
+// entries construct_parsing_table would report.
+int check_ll1(SuffixSets *suffix, ConflictReport *conflicts) {
+    static TermSet seen[MAX_SYMBOLS];
+    IndexedGrammar *ig = suffix->ig;
+    int status = LL1_CHECK_OK;
+    if (conflicts) conflicts->cell_count = 0;
+    memset(seen, 0, sizeof(TermSet) * ig->non_terminal_count);
+
+    for (int a = 0; a < ig->alt_count; a++) {
+        IndexedAlternative *alt = &ig->alts[a];
+        TermSet predict = suffix->suffix_first[suffix->suffix_start[a]];
+        if (suffix->suffix_nullable[suffix->suffix_start[a]]) term_set_union(&predict, &suffix->follow[alt->lhs]);
+
+        TermSet overlap;
+        int any = 0;
+        for (int w = 0; w < SET_WORDS; w++) {
+            overlap.bits[w] = predict.bits[w] & seen[alt->lhs].bits[w];
+            any |= overlap.bits[w] != 0;
+        }
+        term_set_union(&seen[alt->lhs], &predict);
+        if (!any) continue;
+        status = LL1_CHECK_CONFLICT;
+        if (!conflicts) return status;
+
+        // Pair this alternative with every earlier one predicting the same column,
+        // visiting FIRST columns before FOLLOW ones as the table construction does.
+        TermSet *own_first = &suffix->suffix_first[suffix->suffix_start[a]];
+        for (int step = 0; step < 2 * (ig->terminal_count + 1); step++) {
+            int col = step % (ig->terminal_count + 1);
+            int via_follow = step > ig->terminal_count;
+            if (!term_set_has(&overlap, col) || term_set_has(own_first, col) == via_follow) continue;
+            for (int b = 0; b < a; b++) {
+                IndexedAlternative *other = &ig->alts[b];
+                if (other->lhs != alt->lhs) continue;
+                int base = suffix->suffix_start[b];
+                if (term_set_has(&suffix->suffix_first[base], col)) {
+                    add_conflict_entry(conflicts, alt->lhs, col, other->code, 0);
+                } else if (suffix->suffix_nullable[base] && term_set_has(&suffix->follow[alt->lhs], col)) {
+                    add_conflict_entry(conflicts, alt->lhs, col, other->code, 1);
                 }
             }
+            add_conflict_entry(conflicts, alt->lhs, col, alt->code, via_follow);
         }
     }
+    return status;
 }
 
 
 
-void print_grammar(Grammar g) {
-    for (int i = 0; i < g.prod_count; i++) {
-        printf("%s -> ", g.productions[i].lhs);
-        for (int j = 0; j < g.productions[i].rhs_count; j++) {
-            for (int k = 0; k < g.productions[i].symbols_in_rhs[j]; k++) {
-                printf("%s ", g.productions[i].rhs[j][k]);
+void print_grammar(Grammar *g) {
+    for (int i = 0; i < g->prod_count; i++) {
+        printf("%s -> ", g->productions[i].lhs);
+        for (int j = 0; j < g->productions[i].rhs_count; j++) {
+            for (int k = 0; k < g->productions[i].symbols_in_rhs[j]; k++) {
+                printf("%s ", g->productions[i].rhs[j][k]);
             }
             
-            if (j < g.productions[i].rhs_count - 1) {
+            if (j < g->productions[i].rhs_count - 1) {
                 printf("| ");
             }
         }
@@ -920,48 +1816,100 @@ void print_grammar(Grammar g) {
     }
 }
 
-void print_parsing_table(Grammar g, int parsing_table[MAX_SYMBOLS][MAX_SYMBOLS]) {
-    int totalCols = g.terminal_count + 1; // columns for each terminal plus '$'
+// Appends "lhs -> rhs" of a table entry to buf and returns its length.
+static int format_alternative(Grammar *g, int code, char *buf) {
+    Production *prod = &g->productions[code / 1000];
+    int altIndex = code % 1000;
+    int length = strlen(prod->lhs);
+    memcpy(buf, prod->lhs, length);
+    memcpy(buf + length, " -> ", 4);
+    length += 4;
+    for (int k = 0; k < prod->symbols_in_rhs[altIndex]; k++) {
+        int n = strlen(prod->rhs[altIndex][k]);
+        memcpy(buf + length, prod->rhs[altIndex][k], n);
+        length += n;
+        if (k < prod->symbols_in_rhs[altIndex] - 1) buf[length++] = ' ';
+    }
+    buf[length] = '\0';
+    return length;
+}
+
+// Right-aligns text in a cell of the given width.
+static void write_cell(Writer *w, const char *text, int length, int width) {
+    for (int i = length; i < width; i++) writer_char(w, ' ');
+    writer_write(w, text, length);
+}
+
+void print_parsing_table(Grammar *g, int parsing_table[MAX_SYMBOLS][MAX_SYMBOLS]) {
+    static Writer w;
+    // "lhs -> " plus MAX_SYMBOL_LENGTH symbols and separators always fits.
+    char cell[(MAX_SYMBOL_LENGTH + 1) * (MAX_SYMBOL_LENGTH + 2)];
+    int totalCols = g->terminal_count + 1; // columns for each terminal plus '$'
+
+    // Columns are 15 characters wide, or wider if a production needs more.
+    int width = 15;
+    for (int i = 0; i < g->non_terminal_count; i++) {
+        for (int j = 0; j < totalCols; j++) {
+            if (parsing_table[i][j] == -1) continue;
+            int length = format_alternative(g, parsing_table[i][j], cell);
+            if (length > width) width = length;
+        }
+    }
+
+    writer_init_file(&w, stdout);
     // Print header
-    printf("%15s", "");
-    for (int j = 0; j < g.terminal_count; j++) {
-        printf("|%15s", g.terminals[j]);
+    write_cell(&w, "", 0, width);
+    for (int j = 0; j < totalCols; j++) {
+        const char *name = column_name(g, j);
+        writer_char(&w, '|');
+        write_cell(&w, name, strlen(name), width);
     }
-    printf("|%15s\n", "$");
+    writer_char(&w, '\n');
     for (int j = 0; j < totalCols; j++) {
-        printf("+---------------");
+        writer_char(&w, '+');
+        for (int k = 0; k < width; k++) writer_char(&w, '-');
     }
-    printf("+\n");
+    writer_str(&w, "+\n");
 
     // Print rows for each non-terminal.
-    for (int i = 0; i < g.non_terminal_count; i++) {
-        printf("%15s", g.non_terminals[i]);
+    for (int i = 0; i < g->non_terminal_count; i++) {
+        write_cell(&w, g->non_terminals[i], strlen(g->non_terminals[i]), width);
         for (int j = 0; j < totalCols; j++) {
-            printf("|");
+            writer_char(&w, '|');
             if (parsing_table[i][j] != -1) {
-                int code = parsing_table[i][j];
-                int prodIndex = code / 1000;
-                int altIndex = code % 1000;
-                Production prod = g.productions[prodIndex];
-                char prodStr[256] = "";
-                sprintf(prodStr, "%s -> ", prod.lhs);
-                // Print the alternative indicated by altIndex.
-                for (int k = 0; k < prod.symbols_in_rhs[altIndex]; k++) {
-                    strcat(prodStr, prod.rhs[altIndex][k]);
-                    if (k < prod.symbols_in_rhs[altIndex] - 1)
-                        strcat(prodStr, " ");
-                }
-                printf("%15s", prodStr);
+                write_cell(&w, cell, format_alternative(g, parsing_table[i][j], cell), width);
             } else {
-                printf("%15s", "");
+                write_cell(&w, "", 0, width);
             }
         }
-        printf("|\n");
+        writer_str(&w, "|\n");
         for (int j = 0; j < totalCols; j++) {
-            printf("+---------------");
+            writer_char(&w, '+');
+            for (int k = 0; k < width; k++) writer_char(&w, '-');
+        }
+        writer_str(&w, "+\n");
+    }
+    writer_flush(&w);
+}
+
+void print_symbol_sets(Grammar *g, const char *name, char sets[MAX_SYMBOLS][MAX_SYMBOLS][MAX_SYMBOL_LENGTH],
+                       int count[MAX_SYMBOLS])
+{
+    static Writer w;
+    writer_init_file(&w, stdout);
+    for (int i = 0; i < g->non_terminal_count; i++) {
+        writer_str(&w, name);
+        writer_char(&w, '(');
+        writer_str(&w, g->non_terminals[i]);
+        writer_str(&w, ") = { ");
+        for (int j = 0; j < count[i]; j++) {
+            writer_str(&w, sets[i][j]);
+            writer_char(&w, ' ');
+            if (j < count[i] - 1) writer_str(&w, ", ");
         }
-        printf("+\n");
+        writer_str(&w, "}\n");
     }
+    writer_flush(&w);
 }
 
 
@@ -969,18 +1917,18 @@ int is_non_terminal(char* symbol) {
     return isupper(symbol[0]);
 }
 
-int get_non_terminal_index(Grammar g, char* symbol) {
-    for (int i = 0; i < g.non_terminal_count; i++) {
-        if (strcmp(g.non_terminals[i], symbol) == 0) {
+int get_non_terminal_index(Grammar *g, const char *symbol) {
+    for (int i = 0; i < g->non_terminal_count; i++) {
+        if (strcmp(g->non_terminals[i], symbol) == 0) {
             return i;
         }
     }
     return -1;
 }
 
-int get_terminal_index(Grammar g, char* symbol) {
-    for (int i = 0; i < g.terminal_count; i++) {
-        if (strcmp(g.terminals[i], symbol) == 0) {
+int get_terminal_index(Grammar *g, char* symbol) {
+    for (int i = 0; i < g->terminal_count; i++) {
+        if (strcmp(g->terminals[i], symbol) == 0) {
             return i;
         }
     }
@@ -1004,4 +1952,4844 @@ void add_to_set(char set[MAX_SYMBOLS][MAX_SYMBOL_LENGTH], int* count, char* symb
     }
     strcpy(set[*count], symbol);
     (*count)++;
-}
\ No newline at end of file
+}
+void *checked_realloc(void *ptr, size_t size) {
+    void *p = realloc(ptr, size);
+    if (!p) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+// Returns the code of a symbol (see TERMINAL_CODE), or -1 for epsilon and
+// symbols the grammar does not know.
+int get_symbol_code(Grammar *g, char *symbol) {
+    for (int i = 0; i < g->non_terminal_count; i++) {
+        if (strcmp(g->non_terminals[i], symbol) == 0) {
+            return i;
+        }
+    }
+    for (int i = 0; i < g->terminal_count; i++) {
+        if (strcmp(g->terminals[i], symbol) == 0) {
+            return TERMINAL_CODE(i);
+        }
+    }
+    if (strcmp(symbol, "$") == 0) {
+        return TERMINAL_CODE(g->terminal_count);
+    }
+    return -1;
+}
+
+// Prints the alternative stored in a parsing table entry as "A -> x y".
+void print_alternative(Grammar *g, int code) {
+    Production *prod = &g->productions[code / 1000];
+    int altIndex = code % 1000;
+    printf("%s ->", prod->lhs);
+    for (int k = 0; k < prod->symbols_in_rhs[altIndex]; k++) {
+        printf(" %s", prod->rhs[altIndex][k]);
+    }
+}
+
+const char *column_name(Grammar *g, int col) {
+    return (col == g->terminal_count) ? "$" : g->terminals[col];
+}
+
+void index_grammar(Grammar *g, IndexedGrammar *ig) {
+    ig->alt_count = 0;
+    ig->non_terminal_count = g->non_terminal_count;
+    ig->terminal_count = g->terminal_count;
+    ig->start = get_symbol_code(g, g->start_symbol);
+
+    for (int prodIndex = 0; prodIndex < g->prod_count; prodIndex++) {
+        Production *p = &g->productions[prodIndex];
+        int lhs = get_symbol_code(g, p->lhs);
+        if (lhs == -1 || IS_TERMINAL_CODE(lhs)) continue;
+        for (int altIndex = 0; altIndex < p->rhs_count; altIndex++) {
+            IndexedAlternative *alt = &ig->alts[ig->alt_count++];
+            alt->lhs = lhs;
+            alt->code = prodIndex * 1000 + altIndex;
+            alt->length = 0;
+            for (int k = 0; k < p->symbols_in_rhs[altIndex]; k++) {
+                int code = get_symbol_code(g, p->rhs[altIndex][k]);
+                if (code != -1) {
+                    alt->symbols[alt->length++] = code;
+                }
+            }
+        }
+    }
+}
+
+/*
+   LL(k) lookahead analysis.
+   Lookahead sequences are interned in a hashed trie keyed by (parent, terminal),
+   so the k-truncated concatenation of two sequences is a walk along child edges
+   and sets of sequences are plain sorted arrays of node ids. FIRST_k and FOLLOW_k
+   are computed by fixed-point iteration like their LL(1) counterparts; decision
+   trees are only built for the cells where two alternatives share the first token.
+*/
+static unsigned seq_hash(int parent, int terminal) {
+    return (unsigned)parent * 2654435761u ^ (unsigned)(terminal + 1) * 40503u;
+}
+
+static void seq_trie_init(SeqTrie *t, int k, int end_column) {
+    t->k = k;
+    t->end_column = end_column;
+    t->node_count = 0;
+    t->node_capacity = 64;
+    t->nodes = checked_realloc(NULL, t->node_capacity * sizeof(SeqNode));
+    t->bucket_count = 64;
+    t->buckets = checked_realloc(NULL, t->bucket_count * sizeof(int));
+    t->chain = checked_realloc(NULL, t->node_capacity * sizeof(int));
+    for (int i = 0; i < t->bucket_count; i++) t->buckets[i] = -1;
+    // Node 0 is the empty sequence.
+    t->nodes[0].parent = -1;
+    t->nodes[0].terminal = -1;
+    t->nodes[0].length = 0;
+    t->chain[0] = -1;
+    t->node_count = 1;
+}
+
+static void seq_trie_free(SeqTrie *t) {
+    free(t->nodes);
+    free(t->buckets);
+    free(t->chain);
+}
+
+static int seq_complete(SeqTrie *t, int node) {
+    return t->nodes[node].length == t->k || t->nodes[node].terminal == t->end_column;
+}
+
+// Returns the node for sequence(node) followed by terminal, creating it if needed.
+static int seq_trie_child(SeqTrie *t, int node, int terminal) {
+    unsigned h = seq_hash(node, terminal) & (t->bucket_count - 1);
+    for (int n = t->buckets[h]; n != -1; n = t->chain[n]) {
+        if (t->nodes[n].parent == node && t->nodes[n].terminal == terminal) {
+            return n;
+        }
+    }
+
+    if (t->node_count == t->node_capacity) {
+        t->node_capacity *= 2;
+        t->nodes = checked_realloc(t->nodes, t->node_capacity * sizeof(SeqNode));
+        t->chain = checked_realloc(t->chain, t->node_capacity * sizeof(int));
+    }
+    int id = t->node_count++;
+    t->nodes[id].parent = node;
+    t->nodes[id].terminal = terminal;
+    t->nodes[id].length = t->nodes[node].length + 1;
+
+    // Keep the load factor below one by doubling and rehashing.
+    if (t->node_count > t->bucket_count) {
+        t->bucket_count *= 2;
+        t->buckets = checked_realloc(t->buckets, t->bucket_count * sizeof(int));
+        for (int i = 0; i < t->bucket_count; i++) t->buckets[i] = -1;
+        for (int n = 1; n < t->node_count; n++) {
+            unsigned b = seq_hash(t->nodes[n].parent, t->nodes[n].terminal) & (t->bucket_count - 1);
+            t->chain[n] = t->buckets[b];
+            t->buckets[b] = n;
+        }
+    } else {
+        t->chain[id] = t->buckets[h];
+        t->buckets[h] = id;
+    }
+    return id;
+}
+
+// Writes the tokens of a sequence into out and returns its length.
+static int seq_tokens(SeqTrie *t, int node, int out[MAX_LOOKAHEAD]) {
+    int len = t->nodes[node].length;
+    for (int i = len - 1; i >= 0; i--) {
+        out[i] = t->nodes[node].terminal;
+        node = t->nodes[node].parent;
+    }
+    return len;
+}
+
+static int seq_set_add(SeqSet *s, int id) {
+    int lo = 0, hi = s->count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (s->items[mid] < id) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo < s->count && s->items[lo] == id) return 0;
+    if (s->count == s->capacity) {
+        s->capacity = s->capacity ? s->capacity * 2 : 8;
+        s->items = checked_realloc(s->items, s->capacity * sizeof(int));
+    }
+    memmove(&s->items[lo + 1], &s->items[lo], (s->count - lo) * sizeof(int));
+    s->items[lo] = id;
+    s->count++;
+    return 1;
+}
+
+static int seq_set_union(SeqSet *dst, SeqSet *src) {
+    int changed = 0;
+    for (int i = 0; i < src->count; i++) {
+        changed |= seq_set_add(dst, src->items[i]);
+    }
+    return changed;
+}
+
+// out = a concatenated with b, truncated to k tokens.
+static void seq_concat(SeqTrie *t, SeqSet *out, SeqSet *a, SeqSet *b) {
+    int tokens[MAX_LOOKAHEAD];
+    out->count = 0;
+    for (int i = 0; i < a->count; i++) {
+        int x = a->items[i];
+        if (seq_complete(t, x)) {
+            seq_set_add(out, x);
+            continue;
+        }
+        for (int j = 0; j < b->count; j++) {
+            int n = x;
+            int len = seq_tokens(t, b->items[j], tokens);
+            for (int m = 0; m < len && !seq_complete(t, n); m++) {
+                n = seq_trie_child(t, n, tokens[m]);
+            }
+            seq_set_add(out, n);
+        }
+    }
+}
+
+// FIRST_k of the symbols[from..length) of an alternative.
+static void first_k_of_symbols(LLkAnalysis *a, IndexedAlternative *alt, int from, SeqSet *out) {
+    SeqSet single = {0};
+    SeqSet next = {0};
+    out->count = 0;
+    seq_set_add(out, 0);
+    for (int i = from; i < alt->length; i++) {
+        int sym = alt->symbols[i];
+        SeqSet *sym_first;
+        if (IS_TERMINAL_CODE(sym)) {
+            single.count = 0;
+            seq_set_add(&single, seq_trie_child(&a->trie, 0, sym - MAX_SYMBOLS));
+            sym_first = &single;
+        } else {
+            sym_first = &a->first_k[sym];
+        }
+        seq_concat(&a->trie, &next, out, sym_first);
+        SeqSet tmp = *out;
+        *out = next;
+        next = tmp;
+
+        // Stop once every sequence already has k tokens.
+        int open = 0;
+        for (int j = 0; j < out->count && !open; j++) {
+            if (!seq_complete(&a->trie, out->items[j])) open = 1;
+        }
+        if (!open) break;
+    }
+    free(single.items);
+    free(next.items);
+}
+
+static int add_lookahead_node(LLkAnalysis *a, int count) {
+    if (a->node_count + count > a->node_capacity) {
+        while (a->node_count + count > a->node_capacity) {
+            a->node_capacity = a->node_capacity ? a->node_capacity * 2 : 64;
+        }
+        a->nodes = checked_realloc(a->nodes, a->node_capacity * sizeof(LookaheadNode));
+    }
+    int id = a->node_count;
+    a->node_count += count;
+    return id;
+}
+
+typedef struct {
+    int code;
+    int length;
+    int tokens[MAX_LOOKAHEAD];
+} LookaheadPath;
+
+// Fills node with a decision for paths that agree on their first depth tokens
+// and returns the number of tokens inspected below it.
+static int build_lookahead_node(LLkAnalysis *a, int node, LookaheadPath *paths, int count, int depth) {
+    int same = 1;
+    for (int i = 1; i < count; i++) {
+        if (paths[i].code != paths[0].code) same = 0;
+    }
+    a->nodes[node].first_child = -1;
+    a->nodes[node].child_count = 0;
+    if (same) {
+        a->nodes[node].decision = paths[0].code;
+        return depth;
+    }
+    // Paths that ran out of tokens (k reached or ended with '$') cannot be split further.
+    if (depth == a->k || paths[0].length == depth) {
+        a->nodes[node].decision = -2;
+        return depth;
+    }
+
+    // Group the paths by their next token; stable so children stay in column order.
+    for (int i = 1; i < count; i++) {
+        LookaheadPath p = paths[i];
+        int j = i - 1;
+        while (j >= 0 && paths[j].tokens[depth] > p.tokens[depth]) {
+            paths[j + 1] = paths[j];
+            j--;
+        }
+        paths[j + 1] = p;
+    }
+    int groups = 0;
+    for (int i = 0; i < count; i++) {
+        if (i == 0 || paths[i].tokens[depth] != paths[i - 1].tokens[depth]) groups++;
+    }
+
+    int first = add_lookahead_node(a, groups);
+    a->nodes[node].decision = -1;
+    a->nodes[node].first_child = first;
+    a->nodes[node].child_count = groups;
+
+    int deepest = depth;
+    int child = first;
+    for (int i = 0; i < count;) {
+        int j = i;
+        while (j < count && paths[j].tokens[depth] == paths[i].tokens[depth]) j++;
+        a->nodes[child].terminal = paths[i].tokens[depth];
+        int d = build_lookahead_node(a, child, paths + i, j - i, depth + 1);
+        if (d > deepest) deepest = d;
+        child++;
+        i = j;
+    }
+    return deepest;
+}
+
+static int lookahead_tree_resolved(LLkAnalysis *a, int node) {
+    if (a->nodes[node].decision == -2) return 0;
+    for (int i = 0; i < a->nodes[node].child_count; i++) {
+        if (!lookahead_tree_resolved(a, a->nodes[node].first_child + i)) return 0;
+    }
+    return 1;
+}
+
+void compute_llk_analysis(IndexedGrammar *ig, int k, LLkAnalysis *a) {
+    int end_column = ig->terminal_count;
+    memset(a, 0, sizeof(*a));
+    a->k = k;
+    seq_trie_init(&a->trie, k, end_column);
+
+    SeqSet tmp = {0};
+    SeqSet tail = {0};
+
+    // FIRST_k of every non-terminal.
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int i = 0; i < ig->alt_count; i++) {
+            first_k_of_symbols(a, &ig->alts[i], 0, &tmp);
+            changed |= seq_set_union(&a->first_k[ig->alts[i].lhs], &tmp);
+        }
+    }
+
+    // FOLLOW_k: for B in A -> x B y, FOLLOW_k(B) includes FIRST_k(y) . FOLLOW_k(A).
+    if (ig->start >= 0) {
+        seq_set_add(&a->follow_k[ig->start], seq_trie_child(&a->trie, 0, end_column));
+    }
+    changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int i = 0; i < ig->alt_count; i++) {
+            IndexedAlternative *alt = &ig->alts[i];
+            for (int s = 0; s < alt->length; s++) {
+                if (IS_TERMINAL_CODE(alt->symbols[s])) continue;
+                first_k_of_symbols(a, alt, s + 1, &tail);
+                seq_concat(&a->trie, &tmp, &tail, &a->follow_k[alt->lhs]);
+                changed |= seq_set_union(&a->follow_k[alt->symbols[s]], &tmp);
+            }
+        }
+    }
+
+    // Lookahead sets FIRST_k(alt) . FOLLOW_k(lhs) for every alternative.
+    SeqSet *lookahead = checked_realloc(NULL, (ig->alt_count + 1) * sizeof(SeqSet));
+    for (int i = 0; i < ig->alt_count; i++) {
+        SeqSet first = {0};
+        lookahead[i].items = NULL;
+        lookahead[i].count = lookahead[i].capacity = 0;
+        first_k_of_symbols(a, &ig->alts[i], 0, &first);
+        seq_concat(&a->trie, &lookahead[i], &first, &a->follow_k[ig->alts[i].lhs]);
+        free(first.items);
+    }
+
+    // A cell [A, t] needs more lookahead when two alternatives of A predict t.
+    LookaheadPath *paths = NULL;
+    int path_capacity = 0;
+    for (int nt = 0; nt < ig->non_terminal_count; nt++) {
+        for (int col = 0; col <= end_column; col++) {
+            int path_count = 0;
+            int first_code = -1, competing = 0;
+            for (int i = 0; i < ig->alt_count; i++) {
+                if (ig->alts[i].lhs != nt) continue;
+                int predicts = 0;
+                for (int j = 0; j < lookahead[i].count; j++) {
+                    LookaheadPath p;
+                    p.code = ig->alts[i].code;
+                    p.length = seq_tokens(&a->trie, lookahead[i].items[j], p.tokens);
+                    if (p.length == 0 || p.tokens[0] != col) continue;
+                    if (path_count == path_capacity) {
+                        path_capacity = path_capacity ? path_capacity * 2 : 16;
+                        paths = checked_realloc(paths, path_capacity * sizeof(LookaheadPath));
+                    }
+                    paths[path_count++] = p;
+                    predicts = 1;
+                }
+                if (predicts) {
+                    if (first_code == -1) first_code = ig->alts[i].code;
+                    else competing = 1;
+                }
+            }
+            if (!competing) continue;
+
+            if (a->cell_count == a->cell_capacity) {
+                a->cell_capacity = a->cell_capacity ? a->cell_capacity * 2 : 16;
+                a->cells = checked_realloc(a->cells, a->cell_capacity * sizeof(LookaheadCell));
+            }
+            LookaheadCell *cell = &a->cells[a->cell_count++];
+            cell->nt_index = nt;
+            cell->col = col;
+            cell->root = add_lookahead_node(a, 1);
+            a->nodes[cell->root].terminal = col;
+            cell->depth = build_lookahead_node(a, cell->root, paths, path_count, 1);
+            cell->resolved = lookahead_tree_resolved(a, cell->root);
+        }
+    }
+
+    for (int i = 0; i < ig->alt_count; i++) free(lookahead[i].items);
+    free(lookahead);
+    free(paths);
+    free(tmp.items);
+    free(tail.items);
+}
+
+static void print_lookahead_paths(Grammar *g, LLkAnalysis *a, int node, int path[MAX_LOOKAHEAD], int depth) {
+    path[depth - 1] = a->nodes[node].terminal;
+    if (a->nodes[node].child_count == 0) {
+        printf("    ");
+        for (int i = 0; i < depth; i++) printf("%s ", column_name(g, path[i]));
+        if (a->nodes[node].decision == -2) {
+            printf("=> ambiguous\n");
+        } else {
+            printf("=> ");
+            print_alternative(g, a->nodes[node].decision);
+            printf("\n");
+        }
+        return;
+    }
+    for (int i = 0; i < a->nodes[node].child_count; i++) {
+        print_lookahead_paths(g, a, a->nodes[node].first_child + i, path, depth + 1);
+    }
+}
+
+void print_llk_report(Grammar *g, LLkAnalysis *a) {
+    int path[MAX_LOOKAHEAD];
+    printf("\nLL(%d) Lookahead Analysis:\n", a->k);
+    if (a->cell_count == 0) {
+        printf("No conflicting cells, grammar is LL(1).\n");
+        return;
+    }
+    int unresolved = 0;
+    for (int i = 0; i < a->cell_count; i++) {
+        LookaheadCell *cell = &a->cells[i];
+        if (cell->resolved) {
+            printf("[%s, %s] needs %d tokens of lookahead:\n",
+                   g->non_terminals[cell->nt_index], column_name(g, cell->col), cell->depth);
+        } else {
+            printf("[%s, %s] is not resolved by %d tokens of lookahead:\n",
+                   g->non_terminals[cell->nt_index], column_name(g, cell->col), a->k);
+            unresolved++;
+        }
+        print_lookahead_paths(g, a, cell->root, path, 1);
+    }
+    if (unresolved == 0) {
+        printf("Grammar is LL(%d).\n", a->k);
+    } else {
+        printf("Grammar is not LL(%d)!\n", a->k);
+    }
+}
+
+void free_llk_analysis(LLkAnalysis *a) {
+    seq_trie_free(&a->trie);
+    for (int i = 0; i < MAX_SYMBOLS; i++) {
+        free(a->first_k[i].items);
+        free(a->follow_k[i].items);
+    }
+    free(a->nodes);
+    free(a->cells);
+}
+
+/*
+   Conflict analysis.
+   For every conflicting cell [A, t] a shortest sentential form containing A is
+   found by BFS over states (X, ok), where ok means the text to the right of X
+   can start with t. FIRST/FIRST conflicts only need A to be reachable; conflicts
+   involving FOLLOW need ok, so the example shows why t can follow A. One BFS per
+   column covers every non-terminal and is reused by all cells in that column.
+*/
+typedef struct {
+    int prev;       // previous state, -1 for the start symbol
+    int alt;        // alternative expanded to reach this state
+    int pos;        // position of the state's non-terminal in that alternative
+    int seen;
+} DerivationStep;
+
+// BFS from the start symbol; col == -1 ignores the right context.
+static void derivation_bfs(SuffixSets *suffix, int col, DerivationStep steps[2 * MAX_SYMBOLS]) {
+    IndexedGrammar *ig = suffix->ig;
+    int queue[2 * MAX_SYMBOLS];
+    int head = 0, tail = 0;
+    for (int i = 0; i < 2 * MAX_SYMBOLS; i++) steps[i].seen = 0;
+    if (ig->start < 0) return;
+
+    int start_ok = (col == -1 || col == ig->terminal_count);
+    int start = ig->start * 2 + start_ok;
+    steps[start].seen = 1;
+    steps[start].prev = -1;
+    queue[tail++] = start;
+
+    while (head < tail) {
+        int state = queue[head++];
+        int nt = state / 2, ok = state % 2;
+        for (int i = 0; i < ig->alt_count; i++) {
+            IndexedAlternative *alt = &ig->alts[i];
+            if (alt->lhs != nt) continue;
+            for (int p = 0; p < alt->length; p++) {
+                int sym = alt->symbols[p];
+                if (IS_TERMINAL_CODE(sym)) continue;
+                int next_ok = 1;
+                if (col != -1) {
+                    int tail = suffix->suffix_start[i] + p + 1;
+                    next_ok = term_set_has(&suffix->suffix_first[tail], col)
+                              || (suffix->suffix_nullable[tail] && ok);
+                }
+                int next = sym * 2 + next_ok;
+                if (steps[next].seen) continue;
+                steps[next].seen = 1;
+                steps[next].prev = state;
+                steps[next].alt = i;
+                steps[next].pos = p;
+                queue[tail++] = next;
+            }
+        }
+    }
+}
+
+static void json_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fputc('\\', out);
+        fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+static void json_alternative(FILE *out, Grammar *g, int code) {
+    Production *prod = &g->productions[code / 1000];
+    int altIndex = code % 1000;
+    fputc('"', out);
+    fprintf(out, "%s ->", prod->lhs);
+    for (int k = 0; k < prod->symbols_in_rhs[altIndex]; k++) {
+        fputc(' ', out);
+        for (const char *c = prod->rhs[altIndex][k]; *c; c++) {
+            if (*c == '"' || *c == '\\') fputc('\\', out);
+            fputc(*c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static void json_sentential_form(FILE *out, Grammar *g, int *form, int length) {
+    fputc('"', out);
+    if (length == 0) fputs("epsilon", out);
+    for (int i = 0; i < length; i++) {
+        const char *name = IS_TERMINAL_CODE(form[i]) ? column_name(g, form[i] - MAX_SYMBOLS)
+                                                     : g->non_terminals[form[i]];
+        if (i > 0) fputc(' ', out);
+        for (const char *c = name; *c; c++) {
+            if (*c == '"' || *c == '\\') fputc('\\', out);
+            fputc(*c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+// Writes the derivation that leads to target as a JSON array of sentential forms.
+static void json_derivation(FILE *out, Grammar *g, IndexedGrammar *ig, DerivationStep *steps, int target) {
+    int path[2 * MAX_SYMBOLS];
+    int path_len = 0;
+    for (int s = target; steps[s].prev != -1; s = steps[s].prev) path[path_len++] = s;
+
+    int capacity = MAX_SYMBOL_LENGTH * (path_len + 1);
+    int *form = checked_realloc(NULL, capacity * sizeof(int));
+    int *next = checked_realloc(NULL, capacity * sizeof(int));
+    int length = 1, tracked = 0;
+    form[0] = ig->start;
+
+    fputs("[", out);
+    json_sentential_form(out, g, form, length);
+    for (int i = path_len - 1; i >= 0; i--) {
+        DerivationStep *step = &steps[path[i]];
+        IndexedAlternative *alt = &ig->alts[step->alt];
+        int n = 0;
+        for (int j = 0; j < tracked; j++) next[n++] = form[j];
+        for (int j = 0; j < alt->length; j++) next[n++] = alt->symbols[j];
+        for (int j = tracked + 1; j < length; j++) next[n++] = form[j];
+        tracked += step->pos;
+        int *tmp = form;
+        form = next;
+        next = tmp;
+        length = n;
+        fputs(", ", out);
+        json_sentential_form(out, g, form, length);
+    }
+    fputs("]", out);
+    free(form);
+    free(next);
+}
+
+static const char *conflict_kind(int via_follow_a, int via_follow_b) {
+    if (via_follow_a && via_follow_b) return "FOLLOW/FOLLOW";
+    if (via_follow_a || via_follow_b) return "FIRST/FOLLOW";
+    return "FIRST/FIRST";
+}
+
+void write_conflict_report_json(FILE *out, Grammar *g, SuffixSets *suffix, ConflictReport *conflicts) {
+    IndexedGrammar *ig = suffix->ig;
+    // BFS results per column, index terminal_count + 1 is the context-free search.
+    int columns = g->terminal_count + 2;
+    DerivationStep (*steps)[2 * MAX_SYMBOLS] = checked_realloc(NULL, columns * sizeof(*steps));
+    char *done = calloc(columns, 1);
+    if (!done) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+
+    fprintf(out, "{\n  \"ll1\": %s,\n  \"conflicts\": [", conflicts->cell_count ? "false" : "true");
+    for (int c = 0; c < conflicts->cell_count; c++) {
+        ConflictCell *cell = &conflicts->cells[c];
+        int needs_follow = 0;
+        for (int i = 0; i < cell->count; i++) needs_follow |= cell->via_follow[i];
+
+        const char *kind = NULL;
+        for (int i = 0; i < cell->count; i++) {
+            for (int j = i + 1; j < cell->count; j++) {
+                const char *k = conflict_kind(cell->via_follow[i], cell->via_follow[j]);
+                if (!kind) kind = k;
+                else if (strcmp(kind, k) != 0) kind = "MIXED";
+            }
+        }
+
+        fprintf(out, "%s\n    {\n      \"non_terminal\": ", c ? "," : "");
+        json_string(out, g->non_terminals[cell->nt_index]);
+        fputs(",\n      \"terminal\": ", out);
+        json_string(out, column_name(g, cell->col));
+        fputs(",\n      \"kind\": ", out);
+        json_string(out, kind ? kind : "FIRST/FIRST");
+        fputs(",\n      \"alternatives\": [", out);
+        for (int i = 0; i < cell->count; i++) {
+            fprintf(out, "%s\n        {\"production\": ", i ? "," : "");
+            json_alternative(out, g, cell->codes[i]);
+            fprintf(out, ", \"via\": \"%s\"}", cell->via_follow[i] ? "FOLLOW" : "FIRST");
+        }
+        fputs("\n      ],\n      \"pairs\": [", out);
+        int first_pair = 1;
+        for (int i = 0; i < cell->count; i++) {
+            for (int j = i + 1; j < cell->count; j++) {
+                fprintf(out, "%s\n        {\"alternatives\": [%d, %d], \"kind\": \"%s\"}",
+                        first_pair ? "" : ",", i, j, conflict_kind(cell->via_follow[i], cell->via_follow[j]));
+                first_pair = 0;
+            }
+        }
+        fputs("\n      ],\n      \"example\": ", out);
+
+        int slot = needs_follow ? cell->col : g->terminal_count + 1;
+        if (!done[slot]) {
+            derivation_bfs(suffix, needs_follow ? cell->col : -1, steps[slot]);
+            done[slot] = 1;
+        }
+        int target = cell->nt_index * 2 + 1;
+        if (steps[slot][target].seen) {
+            json_derivation(out, g, ig, steps[slot], target);
+        } else {
+            fputs("null", out);
+        }
+        fputs("\n    }", out);
+    }
+    fprintf(out, "%s]\n}\n", conflicts->cell_count ? "\n  " : "");
+
+    free(steps);
+    free(done);
+}
+
+/*
+   Grammar reduction passes.
+   Each pass works on the indexed form of the grammar and rebuilds the Grammar
+   in place from the alternatives it keeps. rename[] maps every non-terminal to
+   the one that replaces it (itself when untouched) and keep[] drops it entirely.
+   Production p is rewritten at an index <= p, so only symbol names need a copy.
+   Returns 1 if the rebuilt grammar has different counts than before.
+*/
+static int grammar_from_indexed(Grammar *g, IndexedGrammar *ig, int keep[MAX_SYMBOLS],
+                                int rename[MAX_SYMBOLS])
+{
+    static char non_terminals[MAX_SYMBOLS][MAX_SYMBOL_LENGTH];
+    static char terminals[MAX_SYMBOLS][MAX_SYMBOL_LENGTH];
+    int used_terminal[MAX_SYMBOLS + 1] = {0};
+    int emitted[MAX_SYMBOLS] = {0};
+    int old_non_terminal_count = g->non_terminal_count;
+    int old_terminal_count = g->terminal_count;
+    int old_prod_count = g->prod_count;
+    int old_alt_total = 0, alt_total = 0;
+
+    for (int p = 0; p < g->prod_count; p++) old_alt_total += g->productions[p].rhs_count;
+    memcpy(non_terminals, g->non_terminals, sizeof(g->non_terminals[0]) * old_non_terminal_count);
+    memcpy(terminals, g->terminals, sizeof(g->terminals[0]) * old_terminal_count);
+
+    g->non_terminal_count = 0;
+    g->terminal_count = 0;
+    for (int i = 0; i < old_non_terminal_count; i++) {
+        if (keep[i] && rename[i] == i) {
+            strcpy(g->non_terminals[g->non_terminal_count++], non_terminals[i]);
+        }
+    }
+    if (ig->start >= 0) {
+        strcpy(g->start_symbol, non_terminals[rename[ig->start]]);
+    }
+
+    int count = 0;
+    for (int p = 0; p < old_prod_count; p++) {
+        int nt = -1;
+        for (int i = 0; i < old_non_terminal_count; i++) {
+            if (strcmp(g->productions[p].lhs, non_terminals[i]) == 0) {
+                nt = i;
+                break;
+            }
+        }
+        if (nt == -1 || !keep[nt] || rename[nt] != nt || emitted[nt]) continue;
+        emitted[nt] = 1;
+
+        Production *prod = &g->productions[count];
+        strcpy(prod->lhs, non_terminals[nt]);
+        prod->rhs_count = 0;
+        for (int i = 0; i < ig->alt_count; i++) {
+            IndexedAlternative *alt = &ig->alts[i];
+            if (alt->lhs != nt) continue;
+
+            int symbols[MAX_SYMBOL_LENGTH];
+            for (int s = 0; s < alt->length; s++) {
+                symbols[s] = IS_TERMINAL_CODE(alt->symbols[s]) ? alt->symbols[s] : rename[alt->symbols[s]];
+            }
+            // Skip alternatives that became identical to an earlier one.
+            int duplicate = 0;
+            for (int j = 0; j < i && !duplicate; j++) {
+                IndexedAlternative *other = &ig->alts[j];
+                if (other->lhs != nt || other->length != alt->length) continue;
+                duplicate = 1;
+                for (int s = 0; s < alt->length; s++) {
+                    int sym = IS_TERMINAL_CODE(other->symbols[s]) ? other->symbols[s] : rename[other->symbols[s]];
+                    if (sym != symbols[s]) {
+                        duplicate = 0;
+                        break;
+                    }
+                }
+            }
+            if (duplicate) continue;
+
+            if (prod->rhs_count >= MAX_RHS) capacity_error("alternatives");
+            int a = prod->rhs_count++;
+            if (alt->length == 0) {
+                strcpy(prod->rhs[a][0], "epsilon");
+                prod->symbols_in_rhs[a] = 1;
+                continue;
+            }
+            for (int s = 0; s < alt->length; s++) {
+                if (IS_TERMINAL_CODE(symbols[s])) {
+                    int col = symbols[s] - MAX_SYMBOLS;
+                    strcpy(prod->rhs[a][s], col == old_terminal_count ? "$" : terminals[col]);
+                    used_terminal[col] = 1;
+                } else {
+                    strcpy(prod->rhs[a][s], non_terminals[symbols[s]]);
+                }
+            }
+            prod->symbols_in_rhs[a] = alt->length;
+        }
+        alt_total += prod->rhs_count;
+        count++;
+    }
+    g->prod_count = count;
+
+    for (int i = 0; i < old_terminal_count; i++) {
+        if (used_terminal[i]) {
+            strcpy(g->terminals[g->terminal_count++], terminals[i]);
+        }
+    }
+    return g->prod_count != old_prod_count || alt_total != old_alt_total ||
+           g->non_terminal_count != old_non_terminal_count || g->terminal_count != old_terminal_count;
+}
+
+// Marks productive non-terminals with a worklist: every alternative counts the
+// non-terminal occurrences not yet known to be productive, and each newly
+// productive non-terminal decrements the counters of the alternatives using it.
+static void compute_productive(IndexedGrammar *ig, int productive[MAX_SYMBOLS]) {
+    static int pending[MAX_ALTERNATIVES];
+    static int occ_alt[MAX_ALTERNATIVES * MAX_SYMBOL_LENGTH];
+    static int occ_next[MAX_ALTERNATIVES * MAX_SYMBOL_LENGTH];
+    int occ_head[MAX_SYMBOLS];
+    int worklist[MAX_SYMBOLS];
+    int occ_count = 0, top = 0;
+
+    for (int i = 0; i < ig->non_terminal_count; i++) {
+        productive[i] = 0;
+        occ_head[i] = -1;
+    }
+    for (int i = 0; i < ig->alt_count; i++) {
+        IndexedAlternative *alt = &ig->alts[i];
+        pending[i] = 0;
+        for (int s = 0; s < alt->length; s++) {
+            if (IS_TERMINAL_CODE(alt->symbols[s])) continue;
+            occ_alt[occ_count] = i;
+            occ_next[occ_count] = occ_head[alt->symbols[s]];
+            occ_head[alt->symbols[s]] = occ_count++;
+            pending[i]++;
+        }
+        if (pending[i] == 0 && !productive[alt->lhs]) {
+            productive[alt->lhs] = 1;
+            worklist[top++] = alt->lhs;
+        }
+    }
+    while (top > 0) {
+        int nt = worklist[--top];
+        for (int o = occ_head[nt]; o != -1; o = occ_next[o]) {
+            int a = occ_alt[o];
+            if (--pending[a] == 0 && !productive[ig->alts[a].lhs]) {
+                productive[ig->alts[a].lhs] = 1;
+                worklist[top++] = ig->alts[a].lhs;
+            }
+        }
+    }
+}
+
+// Marks non-terminals reachable from the start symbol through alternatives
+// whose non-terminals are all productive.
+static void compute_reachable(IndexedGrammar *ig, int productive[MAX_SYMBOLS], int reachable[MAX_SYMBOLS]) {
+    static int alt_next[MAX_ALTERNATIVES];
+    int alt_head[MAX_SYMBOLS];
+    int worklist[MAX_SYMBOLS];
+    int top = 0;
+
+    for (int i = 0; i < ig->non_terminal_count; i++) {
+        reachable[i] = 0;
+        alt_head[i] = -1;
+    }
+    for (int i = ig->alt_count - 1; i >= 0; i--) {
+        alt_next[i] = alt_head[ig->alts[i].lhs];
+        alt_head[ig->alts[i].lhs] = i;
+    }
+    if (ig->start < 0) return;
+    reachable[ig->start] = 1;
+    worklist[top++] = ig->start;
+    while (top > 0) {
+        int nt = worklist[--top];
+        for (int a = alt_head[nt]; a != -1; a = alt_next[a]) {
+            IndexedAlternative *alt = &ig->alts[a];
+            int usable = 1;
+            for (int s = 0; s < alt->length; s++) {
+                if (!IS_TERMINAL_CODE(alt->symbols[s]) && !productive[alt->symbols[s]]) usable = 0;
+            }
+            if (!usable) continue;
+            for (int s = 0; s < alt->length; s++) {
+                int sym = alt->symbols[s];
+                if (!IS_TERMINAL_CODE(sym) && !reachable[sym]) {
+                    reachable[sym] = 1;
+                    worklist[top++] = sym;
+                }
+            }
+        }
+    }
+}
+
+int remove_useless_symbols_in_place(Grammar *g) {
+    static IndexedGrammar ig;
+    int productive[MAX_SYMBOLS], reachable[MAX_SYMBOLS];
+    int keep[MAX_SYMBOLS], rename[MAX_SYMBOLS];
+
+    index_grammar(g, &ig);
+    compute_productive(&ig, productive);
+    compute_reachable(&ig, productive, reachable);
+
+    // Drop alternatives that use a non-productive non-terminal.
+    int kept = 0;
+    for (int i = 0; i < ig.alt_count; i++) {
+        IndexedAlternative *alt = &ig.alts[i];
+        int usable = productive[alt->lhs];
+        for (int s = 0; s < alt->length; s++) {
+            if (!IS_TERMINAL_CODE(alt->symbols[s]) && !productive[alt->symbols[s]]) usable = 0;
+        }
+        if (usable) ig.alts[kept++] = *alt;
+    }
+    ig.alt_count = kept;
+
+    for (int i = 0; i < g->non_terminal_count; i++) {
+        // The start symbol stays even when the language is empty.
+        keep[i] = (productive[i] && reachable[i]) || i == ig.start;
+        rename[i] = i;
+    }
+    return grammar_from_indexed(g, &ig, keep, rename);
+}
+
+// Replaces every alternative A -> B by the alternatives of B.
+int inline_unit_productions_in_place(Grammar *g) {
+    static IndexedGrammar ig;
+    static IndexedGrammar next;
+    int keep[MAX_SYMBOLS], rename[MAX_SYMBOLS];
+    int alt_total[MAX_SYMBOLS], alt_count[MAX_SYMBOLS];
+    int inlined = 0;
+
+    index_grammar(g, &ig);
+    for (int i = 0; i < g->non_terminal_count; i++) {
+        keep[i] = 1;
+        rename[i] = i;
+    }
+
+    // Each round inlines one level; unit cycles end up as A -> A and are dropped.
+    for (int round = 0; round < g->non_terminal_count; round++) {
+        int changed = 0;
+        next = ig;
+        next.alt_count = 0;
+        // alt_count is what a unit contributes (its alternatives in ig), alt_total
+        // what each non-terminal will have in next
+        for (int i = 0; i < g->non_terminal_count; i++) alt_count[i] = 0;
+        for (int i = 0; i < ig.alt_count; i++) alt_count[ig.alts[i].lhs]++;
+        memcpy(alt_total, alt_count, g->non_terminal_count * sizeof(int));
+
+        for (int i = 0; i < ig.alt_count; i++) {
+            IndexedAlternative *alt = &ig.alts[i];
+            int unit = (alt->length == 1 && !IS_TERMINAL_CODE(alt->symbols[0])) ? alt->symbols[0] : -1;
+            if (unit == alt->lhs) {
+                changed = 1;
+                alt_total[alt->lhs]--;
+                continue;
+            }
+            if (unit == -1 || alt_total[alt->lhs] - 1 + alt_count[unit] > MAX_RHS) {
+                next.alts[next.alt_count++] = *alt;
+                continue;
+            }
+            changed = 1;
+            alt_total[alt->lhs] += alt_count[unit] - 1;
+            for (int j = 0; j < ig.alt_count; j++) {
+                if (ig.alts[j].lhs != unit) continue;
+                IndexedAlternative copy = ig.alts[j];
+                copy.lhs = alt->lhs;
+                copy.code = alt->code;
+                next.alts[next.alt_count++] = copy;
+            }
+        }
+        ig = next;
+        if (!changed) break;
+        inlined = 1;
+    }
+
+    return grammar_from_indexed(g, &ig, keep, rename) | inlined;
+}
+
+// Merges non-terminals whose alternatives are identical once equivalent
+// non-terminals are treated as the same symbol (partition refinement).
+int merge_equivalent_non_terminals_in_place(Grammar *g) {
+    static IndexedGrammar ig;
+    int keep[MAX_SYMBOLS], rename[MAX_SYMBOLS];
+    int class_of[MAX_SYMBOLS], next_class[MAX_SYMBOLS];
+    int n;
+
+    index_grammar(g, &ig);
+    n = g->non_terminal_count;
+    for (int i = 0; i < n; i++) class_of[i] = 0;
+
+    int class_count = 1;
+    while (1) {
+        // Two non-terminals stay together only if they were in the same class and
+        // every alternative of one has a matching alternative (by class) in the other.
+        int new_count = 0;
+        for (int i = 0; i < n; i++) next_class[i] = -1;
+        for (int i = 0; i < n; i++) {
+            if (next_class[i] != -1) continue;
+            next_class[i] = new_count;
+            for (int j = i + 1; j < n; j++) {
+                if (next_class[j] != -1 || class_of[j] != class_of[i]) continue;
+                int same = 1;
+                for (int side = 0; side < 2 && same; side++) {
+                    int x = side ? j : i, y = side ? i : j;
+                    for (int a = 0; a < ig.alt_count && same; a++) {
+                        if (ig.alts[a].lhs != x) continue;
+                        int found = 0;
+                        for (int b = 0; b < ig.alt_count && !found; b++) {
+                            if (ig.alts[b].lhs != y || ig.alts[b].length != ig.alts[a].length) continue;
+                            found = 1;
+                            for (int s = 0; s < ig.alts[a].length; s++) {
+                                int sa = ig.alts[a].symbols[s], sb = ig.alts[b].symbols[s];
+                                if (IS_TERMINAL_CODE(sa) || IS_TERMINAL_CODE(sb) ? sa != sb : class_of[sa] != class_of[sb]) {
+                                    found = 0;
+                                    break;
+                                }
+                            }
+                        }
+                        if (!found) same = 0;
+                    }
+                }
+                if (same) next_class[j] = new_count;
+            }
+            new_count++;
+        }
+        memcpy(class_of, next_class, sizeof(int) * n);
+        if (new_count == class_count) break;
+        class_count = new_count;
+    }
+
+    // The start symbol represents its class, otherwise the first member does.
+    for (int i = 0; i < n; i++) {
+        keep[i] = 1;
+        rename[i] = i;
+        for (int j = 0; j < i; j++) {
+            if (class_of[j] == class_of[i]) {
+                rename[i] = j;
+                break;
+            }
+        }
+    }
+    if (ig.start >= 0) {
+        for (int i = 0; i < n; i++) {
+            if (class_of[i] == class_of[ig.start]) rename[i] = ig.start;
+        }
+    }
+    int merged = 0;
+    for (int i = 0; i < n; i++) {
+        if (rename[i] != i) merged = 1;
+    }
+    return grammar_from_indexed(g, &ig, keep, rename) | merged;
+}
+
+int reduce_grammar_in_place(Grammar *g) {
+    int changed = remove_useless_symbols_in_place(g);
+    changed |= inline_unit_productions_in_place(g);
+    changed |= merge_equivalent_non_terminals_in_place(g);
+    // Inlining and merging can leave non-terminals nothing refers to.
+    changed |= remove_useless_symbols_in_place(g);
+    return changed;
+}
+
+Grammar reduce_grammar(Grammar g) {
+    reduce_grammar_in_place(&g);
+    return g;
+}
+
+/*
+   Pass manager.
+   Passes rewrite pm->grammar in place. A pass that reports a change clears the
+   analyses it invalidates, and require_analyses recomputes only what is missing,
+   so a pass that leaves the grammar alone keeps FIRST/FOLLOW and the table.
+   Every transformation changes the symbols themselves, so all of them
+   invalidate everything; the bits leave room for passes that do not.
+*/
+const GrammarPass left_factoring_pass = {"left-factoring", left_factoring_in_place, ANALYSIS_ALL};
+const GrammarPass left_recursion_pass = {"left-recursion", remove_left_recursion_in_place, ANALYSIS_ALL};
+const GrammarPass reduce_pass = {"reduce", reduce_grammar_in_place, ANALYSIS_ALL};
+
+void pass_manager_init(PassManager *pm) {
+    pm->valid = 0;
+    pm->suffix.suffix_first = NULL;
+    pm->suffix.suffix_nullable = NULL;
+    pm->suffix.suffix_capacity = 0;
+    pm->conflicts.cells = NULL;
+    pm->conflicts.cell_count = 0;
+    pm->conflicts.cell_capacity = 0;
+}
+
+// Runs one pass and returns 1 if it changed the grammar. The grammar as it was
+// before the pass is copied to snapshot only when the caller passes one.
+int run_pass(PassManager *pm, const GrammarPass *pass, Grammar *snapshot) {
+    if (snapshot) *snapshot = pm->grammar;
+    int changed = pass->run(&pm->grammar);
+    if (changed) pm->valid &= ~pass->invalidates;
+    return changed;
+}
+
+// Computes the requested analyses and whatever they depend on that is not valid.
+void require_analyses(PassManager *pm, int analyses) {
+    if (analyses & ANALYSIS_TABLE) analyses |= ANALYSIS_FOLLOW;
+    if (analyses & ANALYSIS_FOLLOW) analyses |= ANALYSIS_FIRST;
+    if (analyses & ANALYSIS_FIRST) analyses |= ANALYSIS_INDEX;
+    // Anything computed from a stale input is stale too.
+    if (!(pm->valid & ANALYSIS_INDEX)) pm->valid = 0;
+    if (!(pm->valid & ANALYSIS_FIRST)) pm->valid &= ANALYSIS_INDEX;
+    if (!(pm->valid & ANALYSIS_FOLLOW)) pm->valid &= ANALYSIS_INDEX | ANALYSIS_FIRST;
+
+    int missing = analyses & ~pm->valid;
+    if (missing & ANALYSIS_INDEX) {
+        index_grammar(&pm->grammar, &pm->ig);
+    }
+    if (missing & ANALYSIS_FIRST) {
+        memset(pm->first_count, 0, sizeof(pm->first_count));
+        compute_first_sets(&pm->grammar, pm->first_sets, pm->first_count);
+        compute_suffix_sets(&pm->grammar, &pm->ig, pm->first_sets, pm->first_count, &pm->suffix);
+    }
+    if (missing & ANALYSIS_FOLLOW) {
+        memset(pm->follow_count, 0, sizeof(pm->follow_count));
+        compute_follow_sets(&pm->grammar, &pm->suffix, pm->follow_sets, pm->follow_count);
+    }
+    if (missing & ANALYSIS_TABLE) {
+        memset(pm->parsing_table, -1, sizeof(pm->parsing_table));
+        construct_parsing_table(&pm->grammar, &pm->suffix, pm->parsing_table, &pm->conflicts);
+    }
+    pm->valid |= analyses;
+}
+
+void free_pass_manager(PassManager *pm) {
+    free_suffix_sets(&pm->suffix);
+    free(pm->conflicts.cells);
+    pm->conflicts.cells = NULL;
+    pm->conflicts.cell_count = 0;
+    pm->conflicts.cell_capacity = 0;
+    pm->valid = 0;
+}
+
+// FNV-1a, continued from h.
+static unsigned long long hash_bytes(unsigned long long h, const char *s, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static unsigned long long hash_string(unsigned long long h, const char *s) {
+    return hash_bytes(h, s, strlen(s) + 1);
+}
+
+/*
+   Grammar modules.
+   Besides productions, a grammar file may contain the directives
+       import FILE      (resolved relative to the importing file)
+       start SYMBOL     (start symbol of the root module)
+   which the flat reader ignores, as they have no "->". Operator levels are not
+   supported in modules and are reported as an error. Imports must not form a
+   cycle, every non-terminal is defined in one module only, and a module may
+   only use the non-terminals that it or the modules it imports define, so the
+   summaries never depend on an importing module. Left factoring
+   and left-recursion removal only rewrite the alternatives of one non-terminal,
+   so each module is transformed on its own. Its nullable and FIRST sets are
+   computed from its own productions plus the summaries of the modules it
+   imports, which are analysed first. With a cache directory, a module whose
+   text and imported summaries are unchanged is read back from its cache file
+   instead; since dependants key on the summary rather than the text, editing a
+   module without changing its FIRST sets does not reanalyse them either.
+   Linking concatenates the modules (root first) and takes FIRST from the
+   summaries, so only FOLLOW and the table are computed on the whole grammar.
+*/
+int grammar_file_has_imports(const char *filename) {
+    FILE *file = fopen(filename, "r");
+    char line[256];
+    int found = 0;
+    if (!file) return 0;
+    while (!found && fgets(line, sizeof(line), file)) {
+        char word[16];
+        if (sscanf(line, " %15s", word) == 1 && strcmp(word, "import") == 0) found = 1;
+    }
+    fclose(file);
+    return found;
+}
+
+static char *read_whole_file(const char *filename) {
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        printf("Error opening file %s\n", filename);
+        exit(1);
+    }
+    size_t length = 0, capacity = 4096, n;
+    char *text = checked_realloc(NULL, capacity);
+    while ((n = fread(text + length, 1, capacity - length - 1, file)) > 0) {
+        length += n;
+        if (length + 1 == capacity) {
+            capacity *= 2;
+            text = checked_realloc(text, capacity);
+        }
+    }
+    text[length] = '\0';
+    fclose(file);
+    return text;
+}
+
+// Looks up a non-terminal defined by module m or by a module it imports.
+static GrammarModule *find_summary(ModuleSet *set, GrammarModule *m, const char *name, int *index) {
+    for (int i = 0; i < m->summary_count; i++) {
+        if (strcmp(m->summary_names[i], name) == 0) {
+            *index = i;
+            return m;
+        }
+    }
+    for (int i = 0; i < m->import_count; i++) {
+        GrammarModule *found = find_summary(set, set->modules[m->imports[i]], name, index);
+        if (found) return found;
+    }
+    return NULL;
+}
+
+// Nullable and FIRST of the module's non-terminals, iterated to a fixed point.
+static void analyse_module(ModuleSet *set, GrammarModule *m) {
+    Grammar *g = m->grammar;
+    m->summary_count = 0;
+    for (int p = 0; p < g->prod_count; p++) {
+        int index;
+        if (find_summary(set, m, g->productions[p].lhs, &index) == m) continue;
+        if (find_summary(set, m, g->productions[p].lhs, &index)) {
+            printf("Error: %s in %s is already defined by an imported module\n", g->productions[p].lhs, m->path);
+            exit(1);
+        }
+        strcpy(m->summary_names[m->summary_count], g->productions[p].lhs);
+        m->summary_nullable[m->summary_count] = 0;
+        m->summary_first_count[m->summary_count] = 0;
+        m->summary_count++;
+    }
+
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int p = 0; p < g->prod_count; p++) {
+            Production *prod = &g->productions[p];
+            int lhs;
+            find_summary(set, m, prod->lhs, &lhs);
+            for (int a = 0; a < prod->rhs_count; a++) {
+                int nullable = 1;
+                for (int k = 0; k < prod->symbols_in_rhs[a] && nullable; k++) {
+                    char *symbol = prod->rhs[a][k];
+                    int before = m->summary_first_count[lhs];
+                    if (strcmp(symbol, "epsilon") == 0) continue;
+                    if (!isupper(symbol[0])) {
+                        add_to_set(m->summary_first[lhs], &m->summary_first_count[lhs], symbol);
+                        nullable = 0;
+                    } else {
+                        int index;
+                        GrammarModule *owner = find_summary(set, m, symbol, &index);
+                        if (!owner) {
+                            printf("Error: %s used in %s is not defined by it or a module it imports\n", symbol, m->path);
+                            exit(1);
+                        }
+                        for (int t = 0; t < owner->summary_first_count[index]; t++) {
+                            add_to_set(m->summary_first[lhs], &m->summary_first_count[lhs],
+                                       owner->summary_first[index][t]);
+                        }
+                        nullable = owner->summary_nullable[index];
+                    }
+                    if (m->summary_first_count[lhs] != before) changed = 1;
+                }
+                if (nullable && !m->summary_nullable[lhs]) {
+                    m->summary_nullable[lhs] = 1;
+                    changed = 1;
+                }
+            }
+        }
+    }
+}
+
+static unsigned long long summary_hash(GrammarModule *m) {
+    unsigned long long h = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < m->summary_count; i++) {
+        h = hash_string(h, m->summary_names[i]);
+        h = hash_string(h, m->summary_nullable[i] ? "1" : "0");
+        for (int t = 0; t < m->summary_first_count[i]; t++) h = hash_string(h, m->summary_first[i][t]);
+    }
+    return h;
+}
+
+// Key of a module's analysis: its text and the summaries of its imports.
+static unsigned long long module_key(ModuleSet *set, GrammarModule *m) {
+    unsigned long long h = m->content_hash;
+    for (int i = 0; i < m->import_count; i++) {
+        unsigned long long s = set->modules[m->imports[i]]->summary_hash;
+        h = hash_bytes(h, (const char *)&s, sizeof(s));
+    }
+    return h;
+}
+
+static void module_cache_path(ModuleSet *set, GrammarModule *m, char *path, size_t size) {
+    snprintf(path, size, "%s/%016llx.module", set->cache_dir, hash_string(0xcbf29ce484222325ULL, m->path));
+}
+
+// Cache file: a "key" line, the transformed productions and one "first" line
+// per non-terminal (name, nullable flag, terminals).
+static int read_module_cache(ModuleSet *set, GrammarModule *m, unsigned long long key) {
+    char path[512], line[1024];
+    unsigned long long stored;
+    module_cache_path(set, m, path, sizeof(path));
+    FILE *file = fopen(path, "r");
+    if (!file) return 0;
+    if (!fgets(line, sizeof(line), file) || sscanf(line, "key %llx", &stored) != 1 || stored != key) {
+        fclose(file);
+        return 0;
+    }
+    *m->grammar = read_grammar(file);
+    rewind(file);
+    m->summary_count = 0;
+    while (fgets(line, sizeof(line), file)) {
+        char *word = strtok(line, " \n");
+        if (!word || strcmp(word, "first") != 0) continue;
+        if (m->summary_count >= MAX_SYMBOLS) capacity_error("non-terminals");
+        char *name = strtok(NULL, " \n"), *nullable = strtok(NULL, " \n");
+        if (!name || !nullable || strlen(name) >= MAX_SYMBOL_LENGTH) continue;
+        int i = m->summary_count++;
+        strcpy(m->summary_names[i], name);
+        m->summary_nullable[i] = strcmp(nullable, "1") == 0;
+        m->summary_first_count[i] = 0;
+        while ((word = strtok(NULL, " \n"))) add_to_set(m->summary_first[i], &m->summary_first_count[i], word);
+    }
+    fclose(file);
+    return 1;
+}
+
+static void write_module_cache(ModuleSet *set, GrammarModule *m, unsigned long long key) {
+    char path[512];
+    module_cache_path(set, m, path, sizeof(path));
+    FILE *file = fopen(path, "w");
+    if (!file) return;  // the cache is only an optimization
+    fprintf(file, "key %016llx\n", key);
+    for (int p = 0; p < m->grammar->prod_count; p++) {
+        Production *prod = &m->grammar->productions[p];
+        fprintf(file, "%s ->", prod->lhs);
+        for (int a = 0; a < prod->rhs_count; a++) {
+            if (a > 0) fprintf(file, " |");
+            for (int k = 0; k < prod->symbols_in_rhs[a]; k++) fprintf(file, " %s", prod->rhs[a][k]);
+        }
+        fprintf(file, "\n");
+    }
+    for (int i = 0; i < m->summary_count; i++) {
+        fprintf(file, "first %s %d", m->summary_names[i], m->summary_nullable[i]);
+        for (int t = 0; t < m->summary_first_count[i]; t++) fprintf(file, " %s", m->summary_first[i][t]);
+        fprintf(file, "\n");
+    }
+    fclose(file);
+}
+
+static int load_module(ModuleSet *set, const char *path) {
+    for (int i = 0; i < set->count; i++) {
+        if (strcmp(set->modules[i]->path, path) != 0) continue;
+        if (set->modules[i]->state == 1) {
+            printf("Error: import cycle through %s\n", path);
+            exit(1);
+        }
+        return i;
+    }
+    if (set->count >= MAX_MODULES) capacity_error("modules");
+    if (strlen(path) >= sizeof(set->modules[0]->path)) capacity_error("characters in a module path");
+    int index = set->count++;
+    GrammarModule *m = checked_realloc(NULL, sizeof(GrammarModule));
+    set->modules[index] = m;
+    strcpy(m->path, path);
+    m->grammar = checked_realloc(NULL, sizeof(Grammar));
+    m->start[0] = '\0';
+    m->import_count = 0;
+    m->state = 1;
+    m->from_cache = 0;
+
+    // Directives first: the imports have to be analysed before this module.
+    char *text = read_whole_file(path);
+    m->content_hash = hash_string(0xcbf29ce484222325ULL, text);
+    char *line = text;
+    while (line && *line) {
+        char *next = strchr(line, '\n');
+        if (next) *next++ = '\0';
+        char word[16], name[256];
+        if (sscanf(line, " %15s %255s", word, name) == 2 && !strstr(line, "->")) {
+            if (strcmp(word, "start") == 0) {
+                if (strlen(name) >= MAX_SYMBOL_LENGTH) capacity_error("characters in a symbol");
+                strcpy(m->start, name);
+            } else if (strcmp(word, "import") == 0) {
+                char resolved[512];
+                const char *slash = strrchr(path, '/');
+                if (name[0] == '/' || !slash) snprintf(resolved, sizeof(resolved), "%s", name);
+                else snprintf(resolved, sizeof(resolved), "%.*s/%s", (int)(slash - path), path, name);
+                if (m->import_count >= MAX_MODULES) capacity_error("modules");
+                m->imports[m->import_count++] = load_module(set, resolved);
+            } else if (strcmp(word, "operator") == 0) {
+                // Levels are checked against the untransformed grammar, which linking never sees
+                printf("Error: operator levels in %s are not supported with modules\n", path);
+                exit(1);
+            }
+        }
+        line = next;
+    }
+    free(text);
+
+    unsigned long long key = module_key(set, m);
+    if (set->cache_dir && read_module_cache(set, m, key)) {
+        m->from_cache = 1;
+    } else {
+        FILE *file = fopen(path, "r");
+        *m->grammar = read_grammar(file);
+        fclose(file);
+        left_factoring_in_place(m->grammar);
+        remove_left_recursion_in_place(m->grammar);
+        analyse_module(set, m);
+        if (set->cache_dir) write_module_cache(set, m, key);
+    }
+    m->summary_hash = summary_hash(m);
+    m->state = 2;
+    return index;
+}
+
+void load_grammar_modules(ModuleSet *set, const char *filename) {
+    set->count = 0;
+    load_module(set, filename);
+}
+
+static void add_symbol_name(char names[MAX_SYMBOLS][MAX_SYMBOL_LENGTH], int *count, const char *name, const char *what) {
+    for (int i = 0; i < *count; i++) {
+        if (strcmp(names[i], name) == 0) return;
+    }
+    if (*count >= MAX_SYMBOLS) capacity_error(what);
+    strcpy(names[(*count)++], name);
+}
+
+// Concatenates the modules, root first, and seeds FIRST from their summaries.
+void link_grammar_modules(ModuleSet *set, PassManager *pm) {
+    Grammar *g = &pm->grammar;
+    g->prod_count = 0;
+    g->non_terminal_count = 0;
+    g->terminal_count = 0;
+    for (int i = 0; i < set->count; i++) {
+        Grammar *part = set->modules[i]->grammar;
+        int first_of_module = g->prod_count;
+        if (g->prod_count + part->prod_count > MAX_PRODUCTIONS) capacity_error("productions");
+        for (int p = 0; p < part->prod_count; p++) {
+            Production *prod = &part->productions[p];
+            for (int q = 0; q < first_of_module; q++) {
+                if (strcmp(g->productions[q].lhs, prod->lhs) == 0) {
+                    printf("Error: %s in %s is already defined by another module\n", prod->lhs, set->modules[i]->path);
+                    exit(1);
+                }
+            }
+            g->productions[g->prod_count++] = *prod;
+            add_symbol_name(g->non_terminals, &g->non_terminal_count, prod->lhs, "non-terminals");
+            for (int a = 0; a < prod->rhs_count; a++) {
+                for (int k = 0; k < prod->symbols_in_rhs[a]; k++) {
+                    char *symbol = prod->rhs[a][k];
+                    if (isupper(symbol[0])) add_symbol_name(g->non_terminals, &g->non_terminal_count, symbol, "non-terminals");
+                    else if (strcmp(symbol, "epsilon") != 0) add_symbol_name(g->terminals, &g->terminal_count, symbol, "terminals");
+                }
+            }
+        }
+    }
+    if (g->terminal_count > MAX_SYMBOLS - 2) capacity_error("terminals");
+    GrammarModule *root = set->modules[0];
+    strcpy(g->start_symbol, root->start[0] ? root->start :
+                            root->grammar->prod_count ? root->grammar->productions[0].lhs : "");
+
+    for (int i = 0; i < g->non_terminal_count; i++) {
+        int index;
+        pm->first_count[i] = 0;
+        GrammarModule *owner = NULL;
+        for (int j = 0; j < set->count && !owner; j++) owner = find_summary(set, set->modules[j], g->non_terminals[i], &index);
+        if (!owner) continue;
+        for (int t = 0; t < owner->summary_first_count[index]; t++) {
+            strcpy(pm->first_sets[i][pm->first_count[i]++], owner->summary_first[index][t]);
+        }
+        if (owner->summary_nullable[index]) strcpy(pm->first_sets[i][pm->first_count[i]++], "epsilon");
+    }
+    index_grammar(g, &pm->ig);
+    compute_suffix_sets(g, &pm->ig, pm->first_sets, pm->first_count, &pm->suffix);
+    pm->valid = ANALYSIS_INDEX | ANALYSIS_FIRST;
+}
+
+void free_grammar_modules(ModuleSet *set) {
+    for (int i = 0; i < set->count; i++) {
+        free(set->modules[i]->grammar);
+        free(set->modules[i]);
+    }
+    set->count = 0;
+}
+
+/*
+   Table compression.
+   Terminal columns with identical entries in every row share one equivalence
+   class, and rows that are identical over those classes are stored once. The
+   driver then looks up cells[row_of[A] * class_count + column_class[t]].
+   Entries are indices into IndexedGrammar.alts, so a cell fits in a short.
+*/
+void build_compressed_table(Grammar *g, IndexedGrammar *ig, int parsing_table[MAX_SYMBOLS][MAX_SYMBOLS],
+                            int compress, CompressedTable *t)
+{
+    int columns = g->terminal_count + 1;
+    int rows = g->non_terminal_count;
+    int alt_of_prod[MAX_PRODUCTIONS];
+    int class_rep[MAX_SYMBOLS + 1];
+    int row_rep[MAX_SYMBOLS];
+    static short alt_table[MAX_SYMBOLS][MAX_SYMBOLS + 1];
+
+    // Table entries encode prodIndex * 1000 + altIndex; translate to alternative indices.
+    for (int p = 0; p < MAX_PRODUCTIONS; p++) alt_of_prod[p] = -1;
+    for (int i = ig->alt_count - 1; i >= 0; i--) {
+        alt_of_prod[ig->alts[i].code / 1000] = i - ig->alts[i].code % 1000;
+    }
+    for (int i = 0; i < rows; i++) {
+        for (int j = 0; j < columns; j++) {
+            int code = parsing_table[i][j];
+            alt_table[i][j] = (code == -1 || alt_of_prod[code / 1000] == -1) ? -1
+                              : (short)(alt_of_prod[code / 1000] + code % 1000);
+        }
+    }
+
+    // Column classes, numbered in order of first appearance.
+    t->class_count = 0;
+    for (int j = 0; j < columns; j++) {
+        int cls = -1;
+        for (int c = 0; c < t->class_count && compress; c++) {
+            int same = 1;
+            for (int i = 0; i < rows && same; i++) {
+                if (alt_table[i][j] != alt_table[i][class_rep[c]]) same = 0;
+            }
+            if (same) {
+                cls = c;
+                break;
+            }
+        }
+        if (cls == -1) {
+            cls = t->class_count++;
+            class_rep[cls] = j;
+        }
+        t->column_class[j] = (unsigned char)cls;
+    }
+
+    // Shared rows over the column classes.
+    t->row_count = 0;
+    for (int i = 0; i < rows; i++) {
+        int row = -1;
+        for (int r = 0; r < t->row_count && compress; r++) {
+            int same = 1;
+            for (int c = 0; c < t->class_count && same; c++) {
+                if (alt_table[i][class_rep[c]] != alt_table[row_rep[r]][class_rep[c]]) same = 0;
+            }
+            if (same) {
+                row = r;
+                break;
+            }
+        }
+        if (row == -1) {
+            row = t->row_count++;
+            row_rep[row] = i;
+        }
+        t->row_of[i] = (unsigned char)row;
+    }
+
+    t->cells = checked_realloc(NULL, (t->row_count * t->class_count + 1) * sizeof(short));
+    for (int r = 0; r < t->row_count; r++) {
+        for (int c = 0; c < t->class_count; c++) {
+            t->cells[r * t->class_count + c] = alt_table[row_rep[r]][class_rep[c]];
+        }
+    }
+    t->end_column = g->terminal_count;
+}
+
+size_t compressed_table_bytes(CompressedTable *t) {
+    return t->row_count * t->class_count * sizeof(short)
+           + (t->end_column + 1) * sizeof(t->column_class[0])
+           + t->row_count * sizeof(t->row_of[0]);
+}
+
+void print_compression_report(Grammar *g, CompressedTable *t) {
+    int columns = g->terminal_count + 1;
+    size_t full = (size_t)g->non_terminal_count * columns * sizeof(short);
+    size_t packed = compressed_table_bytes(t);
+    printf("\nTable Compression:\n");
+    printf("Columns: %d terminals -> %d classes\n", columns, t->class_count);
+    printf("Rows: %d non-terminals -> %d distinct rows\n", g->non_terminal_count, t->row_count);
+    printf("Size: %zu bytes -> %zu bytes (ratio %.2f)\n", full, packed,
+           packed ? (double)full / packed : 0.0);
+}
+
+void free_compressed_table(CompressedTable *t) {
+    free(t->cells);
+    t->cells = NULL;
+}
+
+// Reads whitespace separated terminals and appends the '$' column.
+// Unknown tokens are stored as -1 so the driver rejects them.
+int *read_token_file(Grammar *g, const char *filename, int *count) {
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        printf("Error opening file\n");
+        exit(1);
+    }
+    int capacity = 256;
+    int *tokens = checked_realloc(NULL, capacity * sizeof(int));
+    char word[256];
+    *count = 0;
+    while (fscanf(file, "%255s", word) == 1) {
+        if (*count + 1 >= capacity) {
+            capacity *= 2;
+            tokens = checked_realloc(tokens, capacity * sizeof(int));
+        }
+        int code = get_symbol_code(g, word);
+        tokens[(*count)++] = (code != -1 && IS_TERMINAL_CODE(code)) ? code - MAX_SYMBOLS : -1;
+    }
+    fclose(file);
+    tokens[(*count)++] = g->terminal_count;
+    return tokens;
+}
+
+// Table-driven LL(1) parse of a token stream ending in '$'. Returns the number
+// of tokens consumed on success, or -(position + 1) of the offending token.
+// Unless profile is NULL, every table cell used is counted in it.
+int ll1_parse(IndexedGrammar *ig, CompressedTable *t, int *input, int count, ParseProfile *profile) {
+    static int *stack = NULL;
+    static int stack_capacity = 0;
+    int top = 0, pos = 0;
+
+    if (stack_capacity == 0) {
+        stack_capacity = 1024;
+        stack = checked_realloc(NULL, stack_capacity * sizeof(int));
+    }
+    stack[top++] = TERMINAL_CODE(t->end_column);
+    stack[top++] = ig->start;
+
+    while (top > 0) {
+        int sym = stack[--top];
+        int col = input[pos];
+        if (col < 0) return -(pos + 1);
+        if (IS_TERMINAL_CODE(sym)) {
+            if (sym - MAX_SYMBOLS != col) return -(pos + 1);
+            pos++;
+            continue;
+        }
+        int alt = compressed_table_lookup(t, sym, col);
+        if (alt < 0) return -(pos + 1);
+        if (profile) profile->cell[sym][col]++;
+        IndexedAlternative *a = &ig->alts[alt];
+        if (top + a->length > stack_capacity) {
+            stack_capacity = 2 * (top + a->length);
+            stack = checked_realloc(stack, stack_capacity * sizeof(int));
+        }
+        for (int s = a->length - 1; s >= 0; s--) {
+            stack[top++] = a->symbols[s];
+        }
+    }
+    return (pos == count) ? pos : -(pos + 1);
+}
+
+#ifdef __linux__
+// L1 data cache read misses of this process, or -1 when counters are unavailable.
+static int open_l1_miss_counter(void) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                  | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+// A driver under benchmark, called with its tables as context
+typedef int (*BenchParser)(void *context, int *tokens, int count);
+
+typedef struct {
+    IndexedGrammar *ig;
+    CompressedTable *t;
+} TableParser;
+
+static int bench_table_parse(void *context, int *tokens, int count) {
+    TableParser *p = context;
+    return ll1_parse(p->ig, p->t, tokens, count, NULL);
+}
+
+static int bench_profiled_parse(void *context, int *tokens, int count) {
+    return profiled_parse(context, tokens, count);
+}
+
+static void bench_one(const char *label, size_t bytes, BenchParser parse, void *context, int *tokens, int count,
+                      int iterations)
+{
+    struct timespec begin, end;
+    long long misses = -1;
+    int result = 0;
+#ifdef __linux__
+    int fd = open_l1_miss_counter();
+    if (fd != -1) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    for (int i = 0; i < iterations; i++) {
+        result = parse(context, tokens, count);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+#ifdef __linux__
+    if (fd != -1) {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &misses, sizeof(misses)) != sizeof(misses)) misses = -1;
+        close(fd);
+    }
+#endif
+    double seconds = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+    printf("%-12s %10zu bytes  %12.0f tokens/s", label, bytes,
+           seconds > 0 ? (double)count * iterations / seconds : 0.0);
+    if (misses >= 0) printf("  %12lld L1d misses", misses);
+    else printf("  L1d misses n/a");
+    printf("%s\n", result < 0 ? "  (input rejected)" : "");
+}
+
+// Parses the same input with the plain and the compressed table layouts, the
+// layout from a profile if one is given, the GLL hybrid, which agrees with them
+// wherever the table has no conflicts, and the precedence-climbing hybrid when
+// operator levels are marked.
+void benchmark_parser(Grammar *g, IndexedGrammar *ig, SuffixSets *suffix, ConflictReport *conflicts,
+                      int parsing_table[MAX_SYMBOLS][MAX_SYMBOLS], PrattTable *pratt, ParseProfile *profile,
+                      int *tokens, int count, int iterations)
+{
+    static GllParser gll;
+    CompressedTable plain, packed;
+    build_compressed_table(g, ig, parsing_table, 0, &plain);
+    build_compressed_table(g, ig, parsing_table, 1, &packed);
+    TableParser plain_parser = {ig, &plain}, packed_parser = {ig, &packed};
+    printf("\nParser Benchmark (%d tokens x %d runs):\n", count, iterations);
+    bench_one("full", compressed_table_bytes(&plain), bench_table_parse, &plain_parser, tokens, count, iterations);
+    bench_one("compressed", compressed_table_bytes(&packed), bench_table_parse, &packed_parser, tokens, count,
+              iterations);
+    if (profile) {
+        ProfiledTable profiled;
+        build_profiled_table(ig, &packed, profile, &profiled);
+        size_t bytes = (size_t)profiled.row_count * profiled.class_count * sizeof(int)
+                       + profiled.rhs_count * sizeof(int) + (profiled.end_column + 1);
+        bench_one("profiled", bytes, bench_profiled_parse, &profiled, tokens, count, iterations);
+        free_profiled_table(&profiled);
+    }
+
+    struct timespec begin, end;
+    int result = 0;
+    gll_init(&gll, ig, suffix, conflicts, &packed, (size_t)1 << 30);
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    for (int i = 0; i < iterations; i++) {
+        result = gll_parse(&gll, tokens, count);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+    printf("%-12s %10zu bytes  %12.0f tokens/s  %d GLL regions%s\n", "gll hybrid", gll.peak_bytes,
+           seconds > 0 ? (double)count * iterations / seconds : 0.0, gll.regions,
+           result < 0 ? "  (input rejected)" : "");
+    free_gll_parser(&gll);
+
+    if (pratt) {
+        static OperatorOrder applied;
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        for (int i = 0; i < iterations; i++) {
+            result = pratt_parse(ig, &packed, pratt, tokens, count, &applied);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        seconds = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+        printf("%-12s %10zu bytes  %12.0f tokens/s  %d operators climbed%s\n", "pratt hybrid",
+               compressed_table_bytes(&packed), seconds > 0 ? (double)count * iterations / seconds : 0.0,
+               applied.count, result < 0 ? "  (input rejected)" : "");
+        free(applied.positions);
+        applied.positions = NULL;
+        applied.capacity = 0;
+    }
+    free_compressed_table(&plain);
+    free_compressed_table(&packed);
+}
+
+/*
+   Incremental reparsing.
+   An LL(1) parse is a function of the driver stack and the remaining tokens,
+   so the stack recorded when the parse reached a segment summarizes everything
+   before it. An edit reparses from the start of the segment it falls in, using
+   that segment's stack, and stops at the first following untouched segment
+   whose recorded stack equals the current one: from there on the old parse,
+   including its alternatives and its final result, is still valid. Work per
+   edit is the edited segments plus however far the change in the stack
+   reaches, plus a walk over the segment list.
+   A rejection does not discard the segments after it: they keep the stack,
+   alternatives and outcome of the last parse that reached them, and each is
+   the continuation of the one before unless that one was rejected. An edit
+   that fixes the rejection can therefore still converge on them, and the
+   result is then the first rejection recorded from there on, if any. The
+   current parse is the chain from the first segment up to the first segment
+   that records a rejection. Subtrees are not stored as such: the parse result
+   is the leftmost derivation, the concatenation of the alternatives of that
+   chain.
+*/
+static int *copy_ints(const int *items, int count) {
+    int *copy = checked_realloc(NULL, (count ? count : 1) * sizeof(int));
+    memcpy(copy, items, count * sizeof(int));
+    return copy;
+}
+
+static void free_segment(ParseSegment *s) {
+    free(s->tokens);
+    free(s->stack);
+    free(s->alts);
+}
+
+// Splits tokens into new segments at doc->segments[at ..]; returns how many.
+static int insert_segments(IncrementalParse *doc, int at, const int *tokens, int count) {
+    int n = (count + doc->segment_size - 1) / doc->segment_size;
+    if (doc->segment_count + n > doc->segment_capacity) {
+        doc->segment_capacity = 2 * (doc->segment_count + n);
+        doc->segments = checked_realloc(doc->segments, doc->segment_capacity * sizeof(ParseSegment));
+    }
+    memmove(&doc->segments[at + n], &doc->segments[at], (doc->segment_count - at) * sizeof(ParseSegment));
+    for (int k = 0; k < n; k++) {
+        ParseSegment *s = &doc->segments[at + k];
+        int length = count - k * doc->segment_size;
+        if (length > doc->segment_size) length = doc->segment_size;
+        memset(s, 0, sizeof(*s));
+        s->tokens = copy_ints(tokens + k * doc->segment_size, length);
+        s->token_count = length;
+        s->rejected_at = -1;
+    }
+    doc->segment_count += n;
+    return n;
+}
+
+// Runs the driver from segment first (starting at token base) with the given
+// stack, which it frees, and returns the result. At an old segment from
+// dirty_end on whose recorded stack matches, the recorded parse is kept from
+// there on.
+static int drive_segments(IncrementalParse *doc, int first, int dirty_end, int base, int *stack, int depth) {
+    int capacity = depth;
+    int pos = base;
+    for (int i = first; i < doc->segment_count; i++) {
+        ParseSegment *s = &doc->segments[i];
+        if (i >= dirty_end && s->stack && s->depth == depth && memcmp(s->stack, stack, depth * sizeof(int)) == 0) {
+            free(stack);
+            for (; i < doc->segment_count; i++) {
+                doc->reused_segments++;
+                if (doc->segments[i].rejected_at >= 0) return -(pos + doc->segments[i].rejected_at + 1);
+                pos += doc->segments[i].token_count;
+            }
+            return pos;
+        }
+        free(s->stack);
+        s->stack = copy_ints(stack, depth);
+        s->depth = depth;
+        s->alt_count = 0;
+        s->rejected_at = -1;
+        doc->reparsed_tokens += s->token_count;
+
+        int k = 0;
+        while (k < s->token_count) {
+            int col = s->tokens[k];
+            int sym = depth > 0 ? stack[--depth] : -1;
+            if (sym == -1 || col < 0) break;
+            if (IS_TERMINAL_CODE(sym)) {
+                if (sym - MAX_SYMBOLS != col) break;
+                k++;
+                continue;
+            }
+            int alt = compressed_table_lookup(doc->table, sym, col);
+            if (alt < 0) break;
+            if (s->alt_count == s->alt_capacity) {
+                s->alt_capacity = s->alt_capacity ? 2 * s->alt_capacity : 64;
+                s->alts = checked_realloc(s->alts, s->alt_capacity * sizeof(int));
+            }
+            s->alts[s->alt_count++] = alt;
+            IndexedAlternative *a = &doc->ig->alts[alt];
+            if (depth + a->length > capacity) {
+                capacity = 2 * (depth + a->length);
+                stack = checked_realloc(stack, capacity * sizeof(int));
+            }
+            for (int r = a->length - 1; r >= 0; r--) stack[depth++] = a->symbols[r];
+        }
+        if (k < s->token_count) {
+            // Rejected here; the later segments keep what an earlier parse recorded
+            s->rejected_at = k;
+            free(stack);
+            return -(pos + k + 1);
+        }
+        pos += s->token_count;
+    }
+    free(stack);
+    return pos;
+}
+
+// Parses tokens (ending in '$') from scratch and keeps the segments for edits.
+int incremental_parse(IncrementalParse *doc, IndexedGrammar *ig, CompressedTable *t, int *tokens, int count,
+                      int segment_size)
+{
+    memset(doc, 0, sizeof(*doc));
+    doc->ig = ig;
+    doc->table = t;
+    doc->segment_size = segment_size;
+    doc->token_count = count;
+    insert_segments(doc, 0, tokens, count);
+    int *stack = checked_realloc(NULL, 2 * sizeof(int));
+    stack[0] = TERMINAL_CODE(t->end_column);
+    stack[1] = ig->start;
+    doc->result = drive_segments(doc, 0, doc->segment_count, 0, stack, 2);
+    return doc->result;
+}
+
+// Replaces removed tokens at start with inserted ones and reparses. The final
+// '$' cannot be removed.
+int incremental_edit(IncrementalParse *doc, int start, int removed, int *inserted, int inserted_count) {
+    int end = start + removed;
+    if (start < 0 || removed < 0 || end > doc->token_count - 1) {
+        printf("Edit out of range\n");
+        exit(1);
+    }
+    doc->reparsed_tokens = doc->reused_segments = 0;
+
+    // Segment s holds the edit start and segment e the first token after it.
+    // The parse is resumed at the nearest segment the current parse reached.
+    int s = 0, base = 0;
+    while (base + doc->segments[s].token_count <= start) base += doc->segments[s++].token_count;
+    int e = s, e_base = base;
+    while (e_base + doc->segments[e].token_count <= end) e_base += doc->segments[e++].token_count;
+    while (doc->result < 0 && base > -doc->result - 1) base -= doc->segments[--s].token_count;
+    // Tiny edits take the next segment along so that segments do not fragment
+    int old_count = e_base + doc->segments[e].token_count - base;
+    if (old_count + inserted_count - removed < doc->segment_size / 2 && e + 1 < doc->segment_count) {
+        old_count += doc->segments[++e].token_count;
+    }
+
+    int middle_count = old_count + inserted_count - removed;
+    int *middle = checked_realloc(NULL, (middle_count ? middle_count : 1) * sizeof(int));
+    int m = 0, p = base;
+    for (int i = s; i <= e; i++) {
+        for (int k = 0; k < doc->segments[i].token_count; k++, p++) {
+            if (p == start) {
+                memcpy(middle + m, inserted, inserted_count * sizeof(int));
+                m += inserted_count;
+            }
+            if (p < start || p >= end) middle[m++] = doc->segments[i].tokens[k];
+        }
+    }
+
+    // The stack at segment s only depends on the tokens before it
+    int *stack = doc->segments[s].stack;
+    int depth = doc->segments[s].depth;
+    doc->segments[s].stack = NULL;
+    for (int i = s; i <= e; i++) free_segment(&doc->segments[i]);
+    memmove(&doc->segments[s], &doc->segments[e + 1], (doc->segment_count - e - 1) * sizeof(ParseSegment));
+    doc->segment_count -= e - s + 1;
+    int created = insert_segments(doc, s, middle, middle_count);
+    free(middle);
+
+    doc->token_count += inserted_count - removed;
+    doc->result = drive_segments(doc, s, s + created, base, stack, depth);
+    return doc->result;
+}
+
+// The alternatives expanded so far, in leftmost-derivation order.
+int incremental_derivation(IncrementalParse *doc, int **alts) {
+    int count = 0, last = 0;
+    while (last + 1 < doc->segment_count && doc->segments[last].rejected_at < 0) last++;
+    for (int i = 0; i <= last; i++) count += doc->segments[i].alt_count;
+    *alts = checked_realloc(NULL, (count ? count : 1) * sizeof(int));
+    count = 0;
+    for (int i = 0; i <= last; i++) {
+        if (doc->segments[i].alt_count) {
+            memcpy(*alts + count, doc->segments[i].alts, doc->segments[i].alt_count * sizeof(int));
+        }
+        count += doc->segments[i].alt_count;
+    }
+    return count;
+}
+
+// Applies edits from a file, one per line: start position, number of tokens
+// removed, then the tokens inserted. Reports the result and the work done.
+void apply_edit_file(Grammar *g, IncrementalParse *doc, const char *filename) {
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        printf("Error opening file\n");
+        exit(1);
+    }
+    static char line[65536];
+    static int inserted[32768];
+    int number = 0;
+    printf("\nIncremental Edits (%d tokens, segments of %d):\n", doc->token_count, doc->segment_size);
+    while (fgets(line, sizeof(line), file)) {
+        char *word = strtok(line, " \t\r\n");
+        if (!word) continue;
+        int start = atoi(word);
+        word = strtok(NULL, " \t\r\n");
+        int removed = word ? atoi(word) : 0;
+        int count = 0;
+        while ((word = strtok(NULL, " \t\r\n")) && count < (int)(sizeof(inserted) / sizeof(inserted[0]))) {
+            int code = get_symbol_code(g, word);
+            inserted[count++] = (code != -1 && IS_TERMINAL_CODE(code)) ? code - MAX_SYMBOLS : -1;
+        }
+
+        struct timespec begin, end;
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        int result = incremental_edit(doc, start, removed, inserted, count);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double micros = (end.tv_sec - begin.tv_sec) * 1e6 + (end.tv_nsec - begin.tv_nsec) / 1e3;
+        if (result >= 0) printf("Edit %d: accepted", ++number);
+        else printf("Edit %d: rejected at token %d", ++number, -result);
+        printf(", %d tokens reparsed, %d segments reused, %.1f us\n", doc->reparsed_tokens, doc->reused_segments,
+               micros);
+    }
+    fclose(file);
+}
+
+void free_incremental_parse(IncrementalParse *doc) {
+    for (int i = 0; i < doc->segment_count; i++) free_segment(&doc->segments[i]);
+    free(doc->segments);
+    memset(doc, 0, sizeof(*doc));
+}
+
+/*
+   Operator-precedence hybrid.
+   Left recursion removal turns E -> E + T | T into E -> T E', E' -> + T E' |
+   epsilon, so the table driver pays an expansion of E' per operator plus an
+   epsilon expansion per level at the end of every operand. Non-terminals
+   marked as operator levels are instead handed to a precedence climber when
+   the driver pops them: it parses operands (the unmarked non-terminal below
+   the tightest level) with the table driver and consumes the operators of
+   the chain itself. The rest of the grammar, including parenthesized
+   subexpressions inside operands, stays table-driven. The accepted language
+   is unchanged, the marked levels only decide how operators group, which
+   pratt_parse reports as the order the operators are applied in.
+*/
+void read_operator_levels(FILE *file, OperatorLevels *levels) {
+    char line[256];
+    levels->count = 0;
+    while (fgets(line, sizeof(line), file)) {
+        if (strstr(line, "->")) continue;
+        char *word = strtok(line, " \t\r\n");
+        if (!word || strcmp(word, "operator") != 0) continue;
+        char *lhs = strtok(NULL, " \t\r\n");
+        char *assoc = strtok(NULL, " \t\r\n");
+        if (!lhs || !assoc || (strcmp(assoc, "left") != 0 && strcmp(assoc, "right") != 0)) {
+            printf("Expected: operator LHS left|right OP...\n");
+            exit(1);
+        }
+        if (levels->count >= MAX_OPERATOR_LEVELS) capacity_error("operator levels");
+        int i = levels->count++;
+        check_symbol_length(lhs);
+        strcpy(levels->lhs[i], lhs);
+        levels->operand[i][0] = '\0';
+        levels->right_assoc[i] = strcmp(assoc, "right") == 0;
+        levels->op_count[i] = 0;
+        while ((word = strtok(NULL, " \t\r\n"))) {
+            if (levels->op_count[i] >= MAX_RHS) capacity_error("operators in a level");
+            check_symbol_length(word);
+            strcpy(levels->ops[i][levels->op_count[i]++], word);
+        }
+    }
+}
+
+static int operator_level_index(OperatorLevels *levels, const char *name) {
+    for (int i = 0; i < levels->count; i++) {
+        if (strcmp(levels->lhs[i], name) == 0) return i;
+    }
+    return -1;
+}
+
+// Checks on the grammar as read that every alternative of a marked
+// non-terminal A is A OP NEXT with OP one of its operators, or NEXT itself,
+// and records NEXT.
+void check_operator_levels(Grammar *g, OperatorLevels *levels) {
+    for (int i = 0; i < levels->count; i++) {
+        const char *lhs = levels->lhs[i];
+        int base = 0, found = 0;
+        for (int p = 0; p < g->prod_count; p++) {
+            Production *prod = &g->productions[p];
+            if (strcmp(prod->lhs, lhs) != 0) continue;
+            found = 1;
+            for (int a = 0; a < prod->rhs_count; a++) {
+                char (*sym)[MAX_SYMBOL_LENGTH] = prod->rhs[a];
+                const char *next = NULL;
+                if (prod->symbols_in_rhs[a] == 3 && strcmp(sym[0], lhs) == 0) {
+                    int known = 0;
+                    for (int o = 0; o < levels->op_count[i]; o++) known |= strcmp(levels->ops[i][o], sym[1]) == 0;
+                    if (known) next = sym[2];
+                } else if (prod->symbols_in_rhs[a] == 1) {
+                    next = sym[0];
+                    base++;
+                }
+                if (!next || !isupper(next[0]) || strcmp(next, lhs) == 0 ||
+                    (levels->operand[i][0] && strcmp(levels->operand[i], next) != 0)) {
+                    printf("Operator level %s: alternatives must be %s OP NEXT or NEXT\n", lhs, lhs);
+                    exit(1);
+                }
+                strcpy(levels->operand[i], next);
+            }
+        }
+        if (!found || base != 1) {
+            printf("Operator level %s: needs exactly one alternative without an operator\n", lhs);
+            exit(1);
+        }
+    }
+    // Operands may only lead to tighter levels, never back
+    for (int i = 0; i < levels->count; i++) {
+        int j = i, steps = 0;
+        while ((j = operator_level_index(levels, levels->operand[j])) >= 0) {
+            if (++steps > levels->count) {
+                printf("Operator level %s: levels form a cycle\n", levels->lhs[i]);
+                exit(1);
+            }
+        }
+    }
+}
+
+// Lays the levels out chain by chain and resolves them against the
+// transformed grammar, where the marked non-terminals must still exist.
+void build_pratt_table(Grammar *g, OperatorLevels *levels, PrattTable *pt) {
+    for (int i = 0; i < MAX_SYMBOLS; i++) pt->level_of[i] = -1;
+    pt->level_count = 0;
+    for (int i = 0; i < levels->count; i++) {
+        // Chains start at levels no other level uses as its operand
+        int entry = 1;
+        for (int j = 0; j < levels->count; j++) entry &= strcmp(levels->operand[j], levels->lhs[i]) != 0;
+        if (!entry) continue;
+        int first = pt->level_count;
+        for (int j = i; j >= 0; j = operator_level_index(levels, levels->operand[j])) {
+            int l = pt->level_count++;
+            int code = get_symbol_code(g, levels->lhs[j]);
+            if (code == -1 || IS_TERMINAL_CODE(code)) {
+                printf("Operator level %s is not in the transformed grammar\n", levels->lhs[j]);
+                exit(1);
+            }
+            pt->level_of[code] = l;
+            pt->right_assoc[l] = levels->right_assoc[j];
+            memset(&pt->ops[l], 0, sizeof(TermSet));
+            for (int o = 0; o < levels->op_count[j]; o++) {
+                int op = get_symbol_code(g, levels->ops[j][o]);
+                if (op != -1 && IS_TERMINAL_CODE(op)) term_set_add(&pt->ops[l], op - MAX_SYMBOLS);
+            }
+            int primary = get_symbol_code(g, levels->operand[j]);
+            if (primary == -1 || IS_TERMINAL_CODE(primary)) {
+                printf("Operator level %s: operand %s is not in the transformed grammar\n", levels->lhs[j],
+                       levels->operand[j]);
+                exit(1);
+            }
+            for (int k = first; k <= l; k++) pt->primary[k] = primary;
+        }
+        for (int k = first; k < pt->level_count; k++) pt->chain_end[k] = pt->level_count;
+    }
+}
+
+// A precedence climb in progress: the operator whose right operand is being
+// parsed (-1 between operators), and whether an enclosing climb started it
+// for that operand rather than the table driver for a popped level.
+typedef struct {
+    int level;
+    int op;
+    int nested;
+} PrattFrame;
+
+typedef struct {
+    IndexedGrammar *ig;
+    CompressedTable *t;
+    PrattTable *pt;
+    int *input;
+    int pos;
+    int *stack;
+    int capacity;
+    PrattFrame *frames;
+    int frame_count;
+    int frame_capacity;
+    OperatorOrder *order;
+} PrattParse;
+
+// Sits on the driver stack below each operand of a climb
+#define PRATT_OPERAND_END -1
+
+// Pushes an operand of this level above top; returns the new top.
+static int pratt_operand(PrattParse *p, int level, int top) {
+    if (top + 2 > p->capacity) {
+        p->capacity = 2 * (top + 2);
+        p->stack = checked_realloc(p->stack, p->capacity * sizeof(int));
+    }
+    p->stack[top++] = PRATT_OPERAND_END;
+    p->stack[top++] = p->pt->primary[level];
+    return top;
+}
+
+static int pratt_start(PrattParse *p, int level, int nested, int top) {
+    if (p->frame_count == p->frame_capacity) {
+        p->frame_capacity = p->frame_capacity ? 2 * p->frame_capacity : 64;
+        p->frames = checked_realloc(p->frames, p->frame_capacity * sizeof(PrattFrame));
+    }
+    PrattFrame *f = &p->frames[p->frame_count++];
+    f->level = level;
+    f->op = -1;
+    f->nested = nested;
+    return pratt_operand(p, level, top);
+}
+
+static void pratt_apply(PrattParse *p, int op) {
+    OperatorOrder *order = p->order;
+    if (!order) return;
+    if (order->count == order->capacity) {
+        order->capacity = order->capacity ? 2 * order->capacity : 64;
+        order->positions = checked_realloc(order->positions, order->capacity * sizeof(int));
+    }
+    order->positions[order->count++] = op;
+}
+
+// Continues the innermost climb once an operand is complete: applies the
+// operator waiting on it, then consumes the next operator of the chain and
+// pushes its right operand, or ends the climb along with every enclosing one
+// that was waiting on it. Returns the new top.
+static int pratt_resume(PrattParse *p, int top) {
+    PrattTable *pt = p->pt;
+    while (p->frame_count > 0) {
+        PrattFrame *f = &p->frames[p->frame_count - 1];
+        if (f->op >= 0) pratt_apply(p, f->op);
+        f->op = -1;
+        int end = pt->chain_end[f->level];
+        int col = p->input[p->pos];
+        int m = col < 0 ? end : f->level;
+        while (m < end && !term_set_has(&pt->ops[m], col)) m++;
+        if (m < end) {
+            f->op = p->pos++;
+            // Left associative operators only take tighter ones into their right operand
+            int next = pt->right_assoc[m] ? m : m + 1;
+            return next == end ? pratt_operand(p, f->level, top) : pratt_start(p, next, 1, top);
+        }
+        p->frame_count--;
+        if (!f->nested) break;
+    }
+    return top;
+}
+
+// Table-driven parse of the stack; -1 on an error. A popped operator level
+// starts a climb, which consumes the operators of its chain itself and has
+// its operands parsed on the same stack, so nesting costs no C stack.
+static int pratt_drive(PrattParse *p, int top) {
+    while (top > 0) {
+        int sym = p->stack[--top];
+        if (sym == PRATT_OPERAND_END) {
+            top = pratt_resume(p, top);
+            continue;
+        }
+        int col = p->input[p->pos];
+        if (col < 0) return -1;
+        if (IS_TERMINAL_CODE(sym)) {
+            if (sym - MAX_SYMBOLS != col) return -1;
+            p->pos++;
+            continue;
+        }
+        if (p->pt->level_of[sym] >= 0) {
+            top = pratt_start(p, p->pt->level_of[sym], 0, top);
+            continue;
+        }
+        int alt = compressed_table_lookup(p->t, sym, col);
+        if (alt < 0) return -1;
+        IndexedAlternative *a = &p->ig->alts[alt];
+        if (top + a->length > p->capacity) {
+            p->capacity = 2 * (top + a->length);
+            p->stack = checked_realloc(p->stack, p->capacity * sizeof(int));
+        }
+        for (int s = a->length - 1; s >= 0; s--) {
+            p->stack[top++] = a->symbols[s];
+        }
+    }
+    return 0;
+}
+
+// Same contract as ll1_parse. Unless order is NULL, it receives the operators
+// applied by the precedence climber; on a rejection only those completed.
+int pratt_parse(IndexedGrammar *ig, CompressedTable *t, PrattTable *pt, int *input, int count, OperatorOrder *order) {
+    static PrattParse p;
+    if (p.capacity == 0) {
+        p.capacity = 1024;
+        p.stack = checked_realloc(NULL, p.capacity * sizeof(int));
+    }
+    p.ig = ig;
+    p.t = t;
+    p.pt = pt;
+    p.input = input;
+    p.pos = 0;
+    p.order = order;
+    p.frame_count = 0;
+    if (order) order->count = 0;
+    p.stack[0] = TERMINAL_CODE(t->end_column);
+    p.stack[1] = ig->start;
+    int status = pratt_drive(&p, 2);
+    if (status < 0) return -(p.pos + 1);
+    return (p.pos == count) ? p.pos : -(p.pos + 1);
+}
+
+/*
+   Profile-guided layout.
+   The compressed table keeps rows and column classes in the order the reader
+   first met the symbols, and the driver reaches a right-hand side through
+   IndexedGrammar.alts. ll1_parse counts the cells a corpus uses, and
+   build_profiled_table lays out a new table from the counts. The cells serving
+   90% of the lookups decide it: their column classes are stored as a block of
+   their own, row by row with the rows and classes by decreasing use, so those
+   cells are packed at the start instead of being a full row of classes apart;
+   the other classes follow in a second block. The right-hand sides go in one
+   flat array, hottest alternative first. The dispatch is specialized as well:
+   right-hand sides are stored reversed, ready to be copied onto the stack,
+   with non-terminals already turned into row offsets, and an alternative that
+   starts with a terminal matches it during the expansion instead of pushing
+   and popping it (the table only selects such an alternative on that
+   terminal). Cells outside the hot block cost a division to reach. Tables
+   small enough for L1 gain little from the layout itself; the dispatch is
+   what makes the profiled driver faster there.
+*/
+
+// Adds the counts of a profile file to profile. Lines are "cell NT TERMINAL COUNT";
+// cells of symbols the grammar no longer has are skipped.
+void load_parse_profile(Grammar *g, const char *filename, ParseProfile *profile) {
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        printf("Error opening file\n");
+        exit(1);
+    }
+    char line[256], nt[256], term[256];
+    long count;
+    while (fgets(line, sizeof(line), file)) {
+        if (sscanf(line, "cell %255s %255s %ld", nt, term, &count) != 3) continue;
+        int row = get_symbol_code(g, nt);
+        int col = strcmp(term, "$") == 0 ? TERMINAL_CODE(g->terminal_count) : get_symbol_code(g, term);
+        if (row == -1 || IS_TERMINAL_CODE(row) || col == -1 || !IS_TERMINAL_CODE(col)) continue;
+        profile->cell[row][col - MAX_SYMBOLS] += count;
+    }
+    fclose(file);
+}
+
+void save_parse_profile(Grammar *g, const char *filename, ParseProfile *profile) {
+    FILE *file = fopen(filename, "w");
+    if (!file) {
+        printf("Error opening file\n");
+        exit(1);
+    }
+    fprintf(file, "# parse profile: cell NON-TERMINAL TERMINAL COUNT\n");
+    for (int nt = 0; nt < g->non_terminal_count; nt++) {
+        for (int col = 0; col <= g->terminal_count; col++) {
+            if (profile->cell[nt][col]) {
+                fprintf(file, "cell %s %s %ld\n", g->non_terminals[nt], column_name(g, col), profile->cell[nt][col]);
+            }
+        }
+    }
+    fclose(file);
+}
+
+// Indices 0..n-1 by decreasing heat; ties keep their original order.
+static void order_by_heat(const long *heat, int *order, int n) {
+    for (int i = 0; i < n; i++) {
+        int j = i;
+        while (j > 0 && heat[order[j - 1]] < heat[i]) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+}
+
+// Marks the hottest cells until they serve 90% of the profiled lookups;
+// returns how many it marked.
+static int mark_hot_cells(ParseProfile *profile, int non_terminals, int columns,
+                          char hot[MAX_SYMBOLS][MAX_SYMBOLS + 1])
+{
+    long total = 0, covered = 0;
+    int count = 0;
+    memset(hot, 0, sizeof(char) * MAX_SYMBOLS * (MAX_SYMBOLS + 1));
+    for (int nt = 0; nt < non_terminals; nt++) {
+        for (int col = 0; col < columns; col++) total += profile->cell[nt][col];
+    }
+    while (covered * 10 < total * 9) {
+        int best_nt = -1, best_col = -1;
+        for (int nt = 0; nt < non_terminals; nt++) {
+            for (int col = 0; col < columns; col++) {
+                if (hot[nt][col] || !profile->cell[nt][col]) continue;
+                if (best_nt < 0 || profile->cell[nt][col] > profile->cell[best_nt][best_col]) {
+                    best_nt = nt;
+                    best_col = col;
+                }
+            }
+        }
+        if (best_nt < 0) break;
+        hot[best_nt][best_col] = 1;
+        covered += profile->cell[best_nt][best_col];
+        count++;
+    }
+    return count;
+}
+
+// Index in pt->cells of the cell of a class in the row at this offset. Cells
+// outside the hot block are rare enough to afford the division.
+static int profiled_cell(ProfiledTable *pt, int row_offset, int cls) {
+    if (cls < pt->hot_classes) return row_offset + cls;
+    return pt->row_count * pt->hot_classes + row_offset / pt->hot_classes * (pt->class_count - pt->hot_classes) + cls -
+           pt->hot_classes;
+}
+
+void build_profiled_table(IndexedGrammar *ig, CompressedTable *t, ParseProfile *profile, ProfiledTable *pt) {
+    static char hot[MAX_SYMBOLS][MAX_SYMBOLS + 1];
+    static long row_heat[MAX_SYMBOLS], class_heat[MAX_SYMBOLS + 1], alt_heat[MAX_ALTERNATIVES];
+    static int row_order[MAX_SYMBOLS], class_order[MAX_SYMBOLS + 1], alt_order[MAX_ALTERNATIVES];
+    static int new_row[MAX_SYMBOLS], new_class[MAX_SYMBOLS + 1], rhs_offset[MAX_ALTERNATIVES];
+    int columns = t->end_column + 1;
+
+    // Rows and classes by their use in the hot cells, the others after them
+    // in table order; alternatives by all their uses
+    mark_hot_cells(profile, ig->non_terminal_count, columns, hot);
+    memset(row_heat, 0, sizeof(long) * t->row_count);
+    memset(class_heat, 0, sizeof(long) * t->class_count);
+    memset(alt_heat, 0, sizeof(long) * ig->alt_count);
+    for (int nt = 0; nt < ig->non_terminal_count; nt++) {
+        for (int col = 0; col < columns; col++) {
+            long uses = profile->cell[nt][col];
+            int alt = compressed_table_lookup(t, nt, col);
+            if (!uses || alt < 0) continue;
+            alt_heat[alt] += uses;
+            if (!hot[nt][col]) continue;
+            row_heat[t->row_of[nt]] += uses;
+            class_heat[t->column_class[col]] += uses;
+        }
+    }
+    order_by_heat(row_heat, row_order, t->row_count);
+    order_by_heat(class_heat, class_order, t->class_count);
+    order_by_heat(alt_heat, alt_order, ig->alt_count);
+    for (int i = 0; i < t->row_count; i++) new_row[row_order[i]] = i;
+    for (int i = 0; i < t->class_count; i++) new_class[class_order[i]] = i;
+
+    pt->row_count = t->row_count;
+    pt->class_count = t->class_count;
+    // Without hot cells the whole row is the hot block
+    pt->hot_classes = 0;
+    while (pt->hot_classes < t->class_count && class_heat[class_order[pt->hot_classes]]) pt->hot_classes++;
+    if (pt->hot_classes == 0) pt->hot_classes = t->class_count;
+    pt->end_column = t->end_column;
+    for (int col = 0; col < columns; col++) pt->class_of[col] = new_class[t->column_class[col]];
+    for (int nt = 0; nt < ig->non_terminal_count; nt++) pt->row_offset[nt] = new_row[t->row_of[nt]] * pt->hot_classes;
+    pt->start = pt->row_offset[ig->start];
+
+    // Right-hand sides, hottest first, reversed and without a leading terminal
+    int total = 0;
+    for (int a = 0; a < ig->alt_count; a++) total += ig->alts[a].length;
+    pt->rhs = checked_realloc(NULL, (total ? total : 1) * sizeof(int));
+    pt->rhs_count = 0;
+    for (int i = 0; i < ig->alt_count; i++) {
+        IndexedAlternative *a = &ig->alts[alt_order[i]];
+        int skip = a->length > 0 && IS_TERMINAL_CODE(a->symbols[0]);
+        rhs_offset[alt_order[i]] = pt->rhs_count;
+        for (int k = a->length - 1; k >= skip; k--) {
+            int sym = a->symbols[k];
+            pt->rhs[pt->rhs_count++] = IS_TERMINAL_CODE(sym) ? -1 - (sym - MAX_SYMBOLS) : pt->row_offset[sym];
+        }
+    }
+
+    pt->cells = checked_realloc(NULL, ((size_t)t->row_count * t->class_count + 1) * sizeof(int));
+    for (int r = 0; r < t->row_count; r++) {
+        for (int c = 0; c < t->class_count; c++) {
+            int alt = t->cells[r * t->class_count + c];
+            int entry = -1;
+            if (alt >= 0) {
+                IndexedAlternative *a = &ig->alts[alt];
+                int skip = a->length > 0 && IS_TERMINAL_CODE(a->symbols[0]);
+                entry = rhs_offset[alt] << 8 | skip << 7 | (a->length - skip);
+            }
+            int row = new_row[r], cls = new_class[c];
+            pt->cells[profiled_cell(pt, row * pt->hot_classes, cls)] = entry;
+        }
+    }
+}
+
+// Compares where the cells serving 90% of the profiled lookups lie in the
+// compressed and in the profiled layout, and how many lookups the hot block
+// serves; the rest pay a division to reach the other block.
+void print_layout_report(Grammar *g, CompressedTable *t, ProfiledTable *pt, ParseProfile *profile) {
+    static char hot[MAX_SYMBOLS][MAX_SYMBOLS + 1];
+    long total = 0, in_block = 0;
+    int old_low = 1 << 30, old_high = -1, new_low = 1 << 30, new_high = -1;
+    int count = mark_hot_cells(profile, g->non_terminal_count, g->terminal_count + 1, hot);
+    for (int nt = 0; nt < g->non_terminal_count; nt++) {
+        for (int col = 0; col <= g->terminal_count; col++) {
+            total += profile->cell[nt][col];
+            if (pt->class_of[col] < pt->hot_classes) in_block += profile->cell[nt][col];
+            if (!hot[nt][col]) continue;
+            int old_cell = t->row_of[nt] * t->class_count + t->column_class[col];
+            int new_cell = profiled_cell(pt, pt->row_offset[nt], pt->class_of[col]);
+            if (old_cell < old_low) old_low = old_cell;
+            if (old_cell > old_high) old_high = old_cell;
+            if (new_cell < new_low) new_low = new_cell;
+            if (new_cell > new_high) new_high = new_cell;
+        }
+    }
+    printf("\nProfiled Layout:\n");
+    printf("Lookups: %ld, %d cells serve 90%%\n", total, count);
+    if (count > 0) {
+        printf("Hot cells span: %d cells -> %d cells\n", old_high - old_low + 1, new_high - new_low + 1);
+        printf("Hot block: %d of %d classes per row, %d cells serving %.1f%% of lookups\n", pt->hot_classes,
+               pt->class_count, pt->row_count * pt->hot_classes, 100.0 * in_block / total);
+    }
+}
+
+// Same contract as ll1_parse, over a profiled table.
+int profiled_parse(ProfiledTable *pt, int *input, int count) {
+    static int *stack = NULL;
+    static int stack_capacity = 0;
+    int top = 0, pos = 0;
+
+    if (stack_capacity == 0) {
+        stack_capacity = 1024;
+        stack = checked_realloc(NULL, stack_capacity * sizeof(int));
+    }
+    stack[top++] = -1 - pt->end_column;
+    stack[top++] = pt->start;
+
+    while (top > 0) {
+        int sym = stack[--top];
+        int col = input[pos];
+        if (col < 0) return -(pos + 1);
+        if (sym < 0) {
+            if (-1 - sym != col) return -(pos + 1);
+            pos++;
+            continue;
+        }
+        int entry = pt->cells[profiled_cell(pt, sym, pt->class_of[col])];
+        if (entry < 0) return -(pos + 1);
+        int length = entry & 0x7f;
+        pos += (entry >> 7) & 1;
+        if (top + length > stack_capacity) {
+            stack_capacity = 2 * (top + length);
+            stack = checked_realloc(stack, stack_capacity * sizeof(int));
+        }
+        const int *rhs = pt->rhs + (entry >> 8);
+        for (int s = 0; s < length; s++) {
+            stack[top++] = rhs[s];
+        }
+    }
+    return (pos == count) ? pos : -(pos + 1);
+}
+
+void free_profiled_table(ProfiledTable *pt) {
+    free(pt->cells);
+    free(pt->rhs);
+    pt->cells = NULL;
+    pt->rhs = NULL;
+}
+
+/*
+   Buffered writer.
+   The exporters and table printers append to a 64 KB buffer and hand it on in
+   one fwrite or write call when it fills, instead of a printf per symbol.
+   Writing to a file descriptor bypasses stdio entirely, so callers flush
+   stdout first if they mix the two.
+*/
+void writer_init_file(Writer *w, FILE *file) {
+    w->file = file;
+    w->fd = -1;
+    w->failed = 0;
+    w->used = 0;
+}
+
+void writer_init_fd(Writer *w, int fd) {
+    w->file = NULL;
+    w->fd = fd;
+    w->failed = 0;
+    w->used = 0;
+}
+
+void writer_flush(Writer *w) {
+    size_t done = 0;
+    if (w->file) {
+        if (fwrite(w->data, 1, w->used, w->file) != w->used) w->failed = 1;
+        fflush(w->file);
+        done = w->used;
+    }
+#ifdef __linux__
+    while (!w->file && done < w->used) {
+        ssize_t n = write(w->fd, w->data + done, w->used - done);
+        if (n <= 0) {
+            w->failed = 1;
+            break;
+        }
+        done += n;
+    }
+#else
+    if (!w->file) w->failed = 1;
+#endif
+    w->used = 0;
+}
+
+void writer_write(Writer *w, const void *data, size_t length) {
+    const char *bytes = data;
+    while (length > 0) {
+        if (w->used == WRITER_BUFFER_SIZE) writer_flush(w);
+        size_t n = WRITER_BUFFER_SIZE - w->used;
+        if (n > length) n = length;
+        memcpy(w->data + w->used, bytes, n);
+        w->used += n;
+        bytes += n;
+        length -= n;
+    }
+}
+
+void writer_str(Writer *w, const char *s) {
+    writer_write(w, s, strlen(s));
+}
+
+void writer_int(Writer *w, int value) {
+    char digits[12];
+    int n = 0;
+    unsigned magnitude = value < 0 ? -(unsigned)value : (unsigned)value;
+    do {
+        digits[n++] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude);
+    if (value < 0) writer_char(w, '-');
+    while (n > 0) writer_char(w, digits[--n]);
+}
+
+static void writer_u16(Writer *w, unsigned value) {
+    writer_char(w, value & 0xff);
+    writer_char(w, (value >> 8) & 0xff);
+}
+
+static void writer_u64(Writer *w, unsigned long long value) {
+    for (int i = 0; i < 8; i++) writer_char(w, (value >> (8 * i)) & 0xff);
+}
+
+// Quoted string for JSON (escape '"' and '\') or DOT (same rules).
+static void writer_quoted(Writer *w, const char *s) {
+    writer_char(w, '"');
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') writer_char(w, '\\');
+        writer_char(w, *s);
+    }
+    writer_char(w, '"');
+}
+
+// CSV field, quoted only when it contains a separator, quote or newline.
+static void writer_csv_field(Writer *w, const char *s) {
+    if (!strpbrk(s, ",\"\n")) {
+        writer_str(w, s);
+        return;
+    }
+    writer_char(w, '"');
+    for (; *s; s++) {
+        if (*s == '"') writer_char(w, '"');
+        writer_char(w, *s);
+    }
+    writer_char(w, '"');
+}
+
+/*
+   Exporters.
+   All formats describe the grammar the table was built for: its non-terminals,
+   terminal columns ('$' last), alternatives, FIRST (with "epsilon" for nullable
+   non-terminals), FOLLOW and the table, whose cells hold an index into the
+   alternatives or nothing.
+   - json:   one object with those fields.
+   - csv:    rows of section,non_terminal,symbol,value, where section is first,
+             follow or table and value is the production of a table cell.
+   - dot:    the symbol dependency graph; A -> X when X occurs in an alternative
+             of A, solid when X can begin A (it follows only nullable symbols).
+   - binary: little endian; "LL1G", u16 version, non-terminal count, column
+             count, alternative count, start (0xffff if none) and set words;
+             names as u8 length + bytes (non-terminals, then columns); per
+             alternative u16 lhs, u8 length and u16 symbols (0x8000 | column
+             for terminals); one nullable byte per non-terminal; FIRST then
+             FOLLOW as set-words u64 bitsets per non-terminal; the table as
+             u16 alternative indices, 0xffff for empty cells.
+*/
+int export_format_from_name(const char *name) {
+    if (strcmp(name, "json") == 0) return EXPORT_JSON;
+    if (strcmp(name, "csv") == 0) return EXPORT_CSV;
+    if (strcmp(name, "dot") == 0) return EXPORT_DOT;
+    if (strcmp(name, "binary") == 0) return EXPORT_BINARY;
+    return -1;
+}
+
+// Alternative index of every table cell, -1 for empty ones.
+static void table_alternatives(PassManager *pm, short cells[MAX_SYMBOLS][MAX_SYMBOLS]) {
+    static short alt_of_code[MAX_PRODUCTIONS][MAX_RHS];
+    IndexedGrammar *ig = &pm->ig;
+    for (int a = 0; a < ig->alt_count; a++) {
+        alt_of_code[ig->alts[a].code / 1000][ig->alts[a].code % 1000] = a;
+    }
+    for (int i = 0; i < ig->non_terminal_count; i++) {
+        for (int col = 0; col <= ig->terminal_count; col++) {
+            int code = pm->parsing_table[i][col];
+            cells[i][col] = code == -1 ? -1 : alt_of_code[code / 1000][code % 1000];
+        }
+    }
+}
+
+static const char *symbol_name(Grammar *g, int symbol) {
+    return IS_TERMINAL_CODE(symbol) ? column_name(g, symbol - MAX_SYMBOLS) : g->non_terminals[symbol];
+}
+
+static void export_json(Writer *w, PassManager *pm, short cells[MAX_SYMBOLS][MAX_SYMBOLS]) {
+    Grammar *g = &pm->grammar;
+    IndexedGrammar *ig = &pm->ig;
+    int columns = g->terminal_count + 1;
+
+    writer_str(w, "{\n  \"start\": ");
+    writer_quoted(w, g->start_symbol);
+    writer_str(w, ",\n  \"non_terminals\": [");
+    for (int i = 0; i < g->non_terminal_count; i++) {
+        if (i) writer_str(w, ", ");
+        writer_quoted(w, g->non_terminals[i]);
+    }
+    writer_str(w, "],\n  \"terminals\": [");
+    for (int col = 0; col < columns; col++) {
+        if (col) writer_str(w, ", ");
+        writer_quoted(w, column_name(g, col));
+    }
+    writer_str(w, "],\n  \"alternatives\": [");
+    for (int a = 0; a < ig->alt_count; a++) {
+        writer_str(w, a ? ",\n    {\"lhs\": " : "\n    {\"lhs\": ");
+        writer_quoted(w, g->non_terminals[ig->alts[a].lhs]);
+        writer_str(w, ", \"rhs\": [");
+        for (int k = 0; k < ig->alts[a].length; k++) {
+            if (k) writer_str(w, ", ");
+            writer_quoted(w, symbol_name(g, ig->alts[a].symbols[k]));
+        }
+        writer_str(w, "]}");
+    }
+    writer_str(w, "\n  ]");
+    for (int set = 0; set < 2; set++) {
+        writer_str(w, set ? ",\n  \"follow\": {" : ",\n  \"first\": {");
+        for (int i = 0; i < g->non_terminal_count; i++) {
+            writer_str(w, i ? ",\n    " : "\n    ");
+            writer_quoted(w, g->non_terminals[i]);
+            writer_str(w, ": [");
+            int count = set ? pm->follow_count[i] : pm->first_count[i];
+            for (int j = 0; j < count; j++) {
+                if (j) writer_str(w, ", ");
+                writer_quoted(w, set ? pm->follow_sets[i][j] : pm->first_sets[i][j]);
+            }
+            writer_char(w, ']');
+        }
+        writer_str(w, "\n  }");
+    }
+    writer_str(w, ",\n  \"table\": [");
+    for (int i = 0; i < g->non_terminal_count; i++) {
+        writer_str(w, i ? ",\n    [" : "\n    [");
+        for (int col = 0; col < columns; col++) {
+            if (col) writer_str(w, ", ");
+            if (cells[i][col] == -1) writer_str(w, "null");
+            else writer_int(w, cells[i][col]);
+        }
+        writer_char(w, ']');
+    }
+    writer_str(w, "\n  ]\n}\n");
+}
+
+static void export_csv(Writer *w, PassManager *pm, short cells[MAX_SYMBOLS][MAX_SYMBOLS]) {
+    Grammar *g = &pm->grammar;
+    char cell[(MAX_SYMBOL_LENGTH + 1) * (MAX_SYMBOL_LENGTH + 2)];
+    writer_str(w, "section,non_terminal,symbol,value\n");
+    for (int set = 0; set < 2; set++) {
+        for (int i = 0; i < g->non_terminal_count; i++) {
+            int count = set ? pm->follow_count[i] : pm->first_count[i];
+            for (int j = 0; j < count; j++) {
+                writer_str(w, set ? "follow," : "first,");
+                writer_csv_field(w, g->non_terminals[i]);
+                writer_char(w, ',');
+                writer_csv_field(w, set ? pm->follow_sets[i][j] : pm->first_sets[i][j]);
+                writer_str(w, ",\n");
+            }
+        }
+    }
+    for (int i = 0; i < g->non_terminal_count; i++) {
+        for (int col = 0; col <= g->terminal_count; col++) {
+            if (cells[i][col] == -1) continue;
+            format_alternative(g, pm->parsing_table[i][col], cell);
+            writer_str(w, "table,");
+            writer_csv_field(w, g->non_terminals[i]);
+            writer_char(w, ',');
+            writer_csv_field(w, column_name(g, col));
+            writer_char(w, ',');
+            writer_csv_field(w, cell);
+            writer_char(w, '\n');
+        }
+    }
+}
+
+static void export_dot(Writer *w, PassManager *pm) {
+    static char edge[MAX_SYMBOLS][2 * MAX_SYMBOLS + 1];    // 0 none, 1 dashed, 2 solid
+    Grammar *g = &pm->grammar;
+    IndexedGrammar *ig = &pm->ig;
+    int columns = g->terminal_count + 1;
+
+    for (int i = 0; i < g->non_terminal_count; i++) memset(edge[i], 0, sizeof(edge[i]));
+    for (int a = 0; a < ig->alt_count; a++) {
+        IndexedAlternative *alt = &ig->alts[a];
+        int leading = 1;
+        for (int k = 0; k < alt->length; k++) {
+            int symbol = alt->symbols[k];
+            int style = leading ? 2 : 1;
+            if (style > edge[alt->lhs][symbol]) edge[alt->lhs][symbol] = style;
+            if (IS_TERMINAL_CODE(symbol) || !pm->suffix.nullable[symbol]) leading = 0;
+        }
+    }
+
+    writer_str(w, "digraph grammar {\n  rankdir=LR;\n  node [shape=ellipse];\n");
+    for (int i = 0; i < g->non_terminal_count; i++) {
+        writer_str(w, "  n");
+        writer_int(w, i);
+        writer_str(w, " [label=");
+        writer_quoted(w, g->non_terminals[i]);
+        if (i == pm->ig.start) writer_str(w, ", peripheries=2");
+        writer_str(w, "];\n");
+    }
+    for (int col = 0; col < columns; col++) {
+        writer_str(w, "  t");
+        writer_int(w, col);
+        writer_str(w, " [shape=box, label=");
+        writer_quoted(w, column_name(g, col));
+        writer_str(w, "];\n");
+    }
+    for (int i = 0; i < g->non_terminal_count; i++) {
+        for (int target = 0; target < MAX_SYMBOLS + columns; target++) {
+            if (!edge[i][target]) continue;
+            writer_str(w, "  n");
+            writer_int(w, i);
+            writer_str(w, target >= MAX_SYMBOLS ? " -> t" : " -> n");
+            writer_int(w, target >= MAX_SYMBOLS ? target - MAX_SYMBOLS : target);
+            writer_str(w, edge[i][target] == 2 ? ";\n" : " [style=dashed];\n");
+        }
+    }
+    writer_str(w, "}\n");
+}
+
+static void export_binary(Writer *w, PassManager *pm, short cells[MAX_SYMBOLS][MAX_SYMBOLS]) {
+    Grammar *g = &pm->grammar;
+    IndexedGrammar *ig = &pm->ig;
+    int columns = g->terminal_count + 1;
+
+    writer_write(w, "LL1G", 4);
+    writer_u16(w, 1);
+    writer_u16(w, g->non_terminal_count);
+    writer_u16(w, columns);
+    writer_u16(w, ig->alt_count);
+    writer_u16(w, ig->start >= 0 ? ig->start : 0xffff);
+    writer_u16(w, SET_WORDS);
+    for (int i = 0; i < g->non_terminal_count + columns; i++) {
+        const char *name = i < g->non_terminal_count ? g->non_terminals[i] : column_name(g, i - g->non_terminal_count);
+        writer_char(w, strlen(name));
+        writer_str(w, name);
+    }
+    for (int a = 0; a < ig->alt_count; a++) {
+        writer_u16(w, ig->alts[a].lhs);
+        writer_char(w, ig->alts[a].length);
+        for (int k = 0; k < ig->alts[a].length; k++) {
+            int symbol = ig->alts[a].symbols[k];
+            writer_u16(w, IS_TERMINAL_CODE(symbol) ? 0x8000 | (symbol - MAX_SYMBOLS) : symbol);
+        }
+    }
+    for (int i = 0; i < g->non_terminal_count; i++) writer_char(w, pm->suffix.nullable[i]);
+    for (int i = 0; i < g->non_terminal_count; i++) {
+        for (int k = 0; k < SET_WORDS; k++) writer_u64(w, pm->suffix.first[i].bits[k]);
+    }
+    for (int i = 0; i < g->non_terminal_count; i++) {
+        for (int k = 0; k < SET_WORDS; k++) writer_u64(w, pm->suffix.follow[i].bits[k]);
+    }
+    for (int i = 0; i < g->non_terminal_count; i++) {
+        for (int col = 0; col < columns; col++) writer_u16(w, cells[i][col] == -1 ? 0xffff : cells[i][col]);
+    }
+}
+
+// Writes the analysis in the given format; the table must be up to date.
+void export_analysis(Writer *w, int format, PassManager *pm) {
+    static short cells[MAX_SYMBOLS][MAX_SYMBOLS];
+    require_analyses(pm, ANALYSIS_TABLE);
+    table_alternatives(pm, cells);
+    switch (format) {
+    case EXPORT_JSON: export_json(w, pm, cells); break;
+    case EXPORT_CSV: export_csv(w, pm, cells); break;
+    case EXPORT_DOT: export_dot(w, pm); break;
+    case EXPORT_BINARY: export_binary(w, pm, cells); break;
+    }
+}
+
+/*
+   GLL fallback parser.
+   The deterministic driver runs as in ll1_parse until it has to expand a
+   non-terminal in a conflicting cell. Its stack, top first, then becomes a
+   continuation pseudo-alternative and the generalized LL engine takes over:
+   descriptors (slot, GSS node, position, SPPF node) are processed from a
+   worklist, calls to the same slot at the same position share one node of the
+   graph-structured stack, and every derivation is recorded in a binarised
+   shared packed parse forest. Alternatives are still filtered by their
+   predict sets (the FIRST/FOLLOW data of the table), so only the conflicting
+   cells branch. When the worklist drains to one descriptor whose GSS path to
+   the root is a plain chain, the chain is turned back into a driver stack and
+   the deterministic driver continues.
+   GSS nodes, edges, pops, SPPF nodes, packed nodes and descriptors are
+   hash-consed into pools that are reset, not freed, between regions. A parse
+   that would need more than memory_limit bytes stops with GLL_LIMIT_EXCEEDED.
+*/
+#define GLL_EPSILON_SYMBOL (2 * MAX_SYMBOLS + 1)
+#define GLL_CONT_SYMBOL (2 * MAX_SYMBOLS + 2)
+#define GLL_ITEM(pool, type, i) (((type *)(pool).items)[i])
+
+typedef struct { int alt, dot, pos, edges, pops, edge_count; } GssNode;     // node 0 is the root
+typedef struct { int source, target, sppf, next; } GssEdge;
+typedef struct { int owner, sppf, next; } GssPop;
+typedef struct { int label, dot, left, right, packed, packed_count; } SppfNode;   // dot -1: symbol node
+typedef struct { int parent, alt, dot, pivot, left, right, next; } SppfPacked;
+typedef struct { int alt, dot, gss, pos, sppf; } GllDescriptor;
+
+// Grows an array to hold needed items, charging the new bytes to the limit.
+static void *gll_grow(GllParser *p, void *items, int *capacity, size_t size, int needed) {
+    if (needed <= *capacity) return items;
+    int new_capacity = *capacity ? *capacity : 256;
+    while (new_capacity < needed) new_capacity *= 2;
+    size_t extra = (size_t)(new_capacity - *capacity) * size;
+    if (p->bytes + extra > p->memory_limit && p->limit_trap) longjmp(*p->limit_trap, 1);
+    p->bytes += extra;
+    if (p->bytes > p->peak_bytes) p->peak_bytes = p->bytes;
+    *capacity = new_capacity;
+    return checked_realloc(items, new_capacity * size);
+}
+
+static int gll_alloc(GllParser *p, GllPool *pool) {
+    pool->items = gll_grow(p, pool->items, &pool->capacity, pool->size, pool->count + 1);
+    return pool->count++;
+}
+
+static unsigned gll_mix(const int *key, int n) {
+    unsigned long long h = 0x9E3779B97F4A7C15ULL;
+    for (int i = 0; i < n; i++) {
+        h = (h ^ (unsigned)key[i]) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 29;
+    }
+    return (unsigned)(h ^ (h >> 32));
+}
+
+static void gll_hash_reset(GllParser *p, GllHash *h) {
+    if (!h->slots) {
+        int capacity = 0;
+        h->slots = gll_grow(p, NULL, &capacity, sizeof(int) + sizeof(unsigned), 1024);
+        h->hashes = checked_realloc(NULL, capacity * sizeof(unsigned));
+        h->mask = capacity - 1;
+    }
+    memset(h->slots, 0, (h->mask + 1) * sizeof(int));
+    h->count = 0;
+}
+
+typedef int (*GllSame)(GllParser *p, int index, const int *key);
+
+// Slot holding the matching entry, or the empty slot where it belongs.
+static int *gll_hash_lookup(GllParser *p, GllHash *h, unsigned hash, GllSame same, const int *key) {
+    unsigned i = hash & h->mask;
+    while (h->slots[i]) {
+        if (h->hashes[i] == hash && same(p, h->slots[i] - 1, key)) return &h->slots[i];
+        i = (i + 1) & h->mask;
+    }
+    return &h->slots[i];
+}
+
+static void gll_hash_insert(GllParser *p, GllHash *h, int *slot, unsigned hash, int index) {
+    *slot = index + 1;
+    h->hashes[slot - h->slots] = hash;
+    if (++h->count * 2 <= (int)h->mask + 1) return;
+
+    // Double and reinsert by the stored hashes.
+    int old_capacity = h->mask + 1, capacity = old_capacity;
+    int *old_slots = h->slots;
+    unsigned *old_hashes = h->hashes;
+    // gll_grow charges the added slots, so p->bytes keeps counting the whole index.
+    h->slots = gll_grow(p, NULL, &capacity, sizeof(int) + sizeof(unsigned), old_capacity * 2);
+    h->hashes = checked_realloc(NULL, capacity * sizeof(unsigned));
+    h->mask = capacity - 1;
+    memset(h->slots, 0, capacity * sizeof(int));
+    for (int i = 0; i < old_capacity; i++) {
+        if (!old_slots[i]) continue;
+        unsigned j = old_hashes[i] & h->mask;
+        while (h->slots[j]) j = (j + 1) & h->mask;
+        h->slots[j] = old_slots[i];
+        h->hashes[j] = old_hashes[i];
+    }
+    free(old_slots);
+    free(old_hashes);
+}
+
+static int same_gss(GllParser *p, int i, const int *k) {
+    GssNode *n = &GLL_ITEM(p->gss, GssNode, i);
+    return n->alt == k[0] && n->dot == k[1] && n->pos == k[2];
+}
+
+static int same_edge(GllParser *p, int i, const int *k) {
+    GssEdge *e = &GLL_ITEM(p->edges, GssEdge, i);
+    return e->source == k[0] && e->target == k[1] && e->sppf == k[2];
+}
+
+static int same_pop(GllParser *p, int i, const int *k) {
+    GssPop *o = &GLL_ITEM(p->pops, GssPop, i);
+    return o->owner == k[0] && o->sppf == k[1];
+}
+
+static int same_sppf(GllParser *p, int i, const int *k) {
+    SppfNode *n = &GLL_ITEM(p->sppf, SppfNode, i);
+    return n->label == k[0] && n->dot == k[1] && n->left == k[2] && n->right == k[3];
+}
+
+static int same_packed(GllParser *p, int i, const int *k) {
+    SppfPacked *n = &GLL_ITEM(p->packed, SppfPacked, i);
+    return n->parent == k[0] && n->alt == k[1] && n->dot == k[2] && n->pivot == k[3];
+}
+
+static int same_descriptor(GllParser *p, int i, const int *k) {
+    GllDescriptor *d = &GLL_ITEM(p->descriptors, GllDescriptor, i);
+    return d->alt == k[0] && d->dot == k[1] && d->gss == k[2] && d->pos == k[3] && d->sppf == k[4];
+}
+
+// The continuation is alternative ig->alt_count.
+static int gll_length(GllParser *p, int alt) {
+    return alt == p->ig->alt_count ? p->cont_length : p->ig->alts[alt].length;
+}
+
+static int gll_symbol(GllParser *p, int alt, int dot) {
+    return alt == p->ig->alt_count ? p->cont[dot] : p->ig->alts[alt].symbols[dot];
+}
+
+static int gll_lhs(GllParser *p, int alt) {
+    return alt == p->ig->alt_count ? GLL_CONT_SYMBOL : p->ig->alts[alt].lhs;
+}
+
+static int gll_sppf_node(GllParser *p, int label, int dot, int left, int right) {
+    int key[4] = {label, dot, left, right};
+    unsigned h = gll_mix(key, 4);
+    int *slot = gll_hash_lookup(p, &p->sppf_index, h, same_sppf, key);
+    if (*slot) return *slot - 1;
+    int n = gll_alloc(p, &p->sppf);
+    SppfNode *node = &GLL_ITEM(p->sppf, SppfNode, n);
+    node->label = label;
+    node->dot = dot;
+    node->left = left;
+    node->right = right;
+    node->packed = -1;
+    node->packed_count = 0;
+    gll_hash_insert(p, &p->sppf_index, slot, h, n);
+    return n;
+}
+
+// getNodeP: the forest node for slot (alt, dot) over w followed by z.
+static int gll_node_p(GllParser *p, int alt, int dot, int w, int z) {
+    int length = gll_length(p, alt);
+    if (dot == 1 && dot < length) {
+        int first = gll_symbol(p, alt, 0);
+        if (IS_TERMINAL_CODE(first) || !p->nullable[first]) return z;
+    }
+    int pivot = GLL_ITEM(p->sppf, SppfNode, z).left;
+    int right = GLL_ITEM(p->sppf, SppfNode, z).right;
+    int left = w == -1 ? pivot : GLL_ITEM(p->sppf, SppfNode, w).left;
+    int y = dot == length ? gll_sppf_node(p, gll_lhs(p, alt), -1, left, right)
+                          : gll_sppf_node(p, alt, dot, left, right);
+
+    int key[4] = {y, alt, dot, pivot};
+    unsigned h = gll_mix(key, 4);
+    int *slot = gll_hash_lookup(p, &p->packed_index, h, same_packed, key);
+    if (*slot) return y;
+    int n = gll_alloc(p, &p->packed);
+    SppfPacked *packed = &GLL_ITEM(p->packed, SppfPacked, n);
+    SppfNode *parent = &GLL_ITEM(p->sppf, SppfNode, y);
+    packed->parent = y;
+    packed->alt = alt;
+    packed->dot = dot;
+    packed->pivot = pivot;
+    packed->left = w;
+    packed->right = z;
+    packed->next = parent->packed;
+    parent->packed = n;
+    parent->packed_count++;
+    gll_hash_insert(p, &p->packed_index, slot, h, n);
+    return y;
+}
+
+static void gll_add(GllParser *p, int alt, int dot, int gss, int pos, int sppf) {
+    int key[5] = {alt, dot, gss, pos, sppf};
+    unsigned h = gll_mix(key, 5);
+    int *slot = gll_hash_lookup(p, &p->descriptor_index, h, same_descriptor, key);
+    if (*slot) return;
+    int n = gll_alloc(p, &p->descriptors);
+    GllDescriptor *d = &GLL_ITEM(p->descriptors, GllDescriptor, n);
+    d->alt = alt;
+    d->dot = dot;
+    d->gss = gss;
+    d->pos = pos;
+    d->sppf = sppf;
+    gll_hash_insert(p, &p->descriptor_index, slot, h, n);
+    p->pending = gll_grow(p, p->pending, &p->pending_capacity, sizeof(int), p->pending_count + 1);
+    p->pending[p->pending_count++] = n;
+}
+
+// Returns to every caller of u with the result z ending at pos.
+static void gll_pop(GllParser *p, int u, int pos, int z, int count) {
+    if (u == 0) {
+        if (pos == count) p->root = z;
+        return;
+    }
+    int key[2] = {u, z};
+    unsigned h = gll_mix(key, 2);
+    int *slot = gll_hash_lookup(p, &p->pop_index, h, same_pop, key);
+    if (*slot) return;
+    int n = gll_alloc(p, &p->pops);
+    GssPop *pop = &GLL_ITEM(p->pops, GssPop, n);
+    pop->owner = u;
+    pop->sppf = z;
+    pop->next = GLL_ITEM(p->gss, GssNode, u).pops;
+    GLL_ITEM(p->gss, GssNode, u).pops = n;
+    gll_hash_insert(p, &p->pop_index, slot, h, n);
+
+    int alt = GLL_ITEM(p->gss, GssNode, u).alt, dot = GLL_ITEM(p->gss, GssNode, u).dot;
+    for (int e = GLL_ITEM(p->gss, GssNode, u).edges; e != -1; e = GLL_ITEM(p->edges, GssEdge, e).next) {
+        GssEdge edge = GLL_ITEM(p->edges, GssEdge, e);
+        gll_add(p, alt, dot, edge.target, pos, gll_node_p(p, alt, dot, edge.sppf, z));
+    }
+}
+
+// Calls from slot (alt, dot - 1) at pos: returns the GSS node to continue at
+// (alt, dot), linked to caller, and replays results already popped from it.
+static int gll_create(GllParser *p, int alt, int dot, int caller, int pos, int w) {
+    int key[3] = {alt, dot, pos};
+    unsigned h = gll_mix(key, 3);
+    int *slot = gll_hash_lookup(p, &p->gss_index, h, same_gss, key);
+    int v = *slot - 1;
+    if (v < 0) {
+        v = gll_alloc(p, &p->gss);
+        GssNode *node = &GLL_ITEM(p->gss, GssNode, v);
+        node->alt = alt;
+        node->dot = dot;
+        node->pos = pos;
+        node->edges = -1;
+        node->pops = -1;
+        node->edge_count = 0;
+        gll_hash_insert(p, &p->gss_index, slot, h, v);
+    }
+
+    int edge_key[3] = {v, caller, w};
+    h = gll_mix(edge_key, 3);
+    slot = gll_hash_lookup(p, &p->edge_index, h, same_edge, edge_key);
+    if (*slot) return v;
+    int e = gll_alloc(p, &p->edges);
+    GssEdge *edge = &GLL_ITEM(p->edges, GssEdge, e);
+    edge->source = v;
+    edge->target = caller;
+    edge->sppf = w;
+    edge->next = GLL_ITEM(p->gss, GssNode, v).edges;
+    GLL_ITEM(p->gss, GssNode, v).edges = e;
+    GLL_ITEM(p->gss, GssNode, v).edge_count++;
+    gll_hash_insert(p, &p->edge_index, slot, h, e);
+
+    for (int o = GLL_ITEM(p->gss, GssNode, v).pops; o != -1; o = GLL_ITEM(p->pops, GssPop, o).next) {
+        int z = GLL_ITEM(p->pops, GssPop, o).sppf;
+        gll_add(p, alt, dot, caller, GLL_ITEM(p->sppf, SppfNode, z).right, gll_node_p(p, alt, dot, w, z));
+    }
+    return v;
+}
+
+static void gll_process(GllParser *p, int *input, int count, GllDescriptor d) {
+    int alt = d.alt, dot = d.dot, u = d.gss, pos = d.pos, w = d.sppf;
+    int length = gll_length(p, alt);
+    if (length == 0) {
+        int epsilon = gll_sppf_node(p, GLL_EPSILON_SYMBOL, -1, pos, pos);
+        gll_pop(p, u, pos, gll_node_p(p, alt, 0, -1, epsilon), count);
+        return;
+    }
+    while (dot < length) {
+        int symbol = gll_symbol(p, alt, dot);
+        if (pos > p->furthest) p->furthest = pos;
+        if (pos >= count || input[pos] < 0) return;
+        int col = input[pos];
+        if (IS_TERMINAL_CODE(symbol)) {
+            if (symbol - MAX_SYMBOLS != col) return;
+            int leaf = gll_sppf_node(p, symbol, -1, pos, pos + 1);
+            pos++;
+            dot++;
+            w = gll_node_p(p, alt, dot, w, leaf);
+            continue;
+        }
+        int v = gll_create(p, alt, dot + 1, u, pos, w);
+        for (int i = p->alts_start[symbol]; i < p->alts_start[symbol + 1]; i++) {
+            int b = p->alts_list[i];
+            if (term_set_has(&p->predict[b], col)) gll_add(p, b, 0, v, pos, -1);
+        }
+        return;
+    }
+    gll_pop(p, u, pos, w, count);
+}
+
+static void gll_push(GllParser *p, int *top, int symbol) {
+    p->stack = gll_grow(p, p->stack, &p->stack_capacity, sizeof(int), *top + 1);
+    p->stack[(*top)++] = symbol;
+}
+
+// 1 if every GSS node from u down to the root has a single caller.
+static int gll_single_path(GllParser *p, int u) {
+    while (u != 0) {
+        GssNode *node = &GLL_ITEM(p->gss, GssNode, u);
+        if (node->edge_count != 1) return 0;
+        u = GLL_ITEM(p->edges, GssEdge, node->edges).target;
+    }
+    return 1;
+}
+
+// Rebuilds the driver stack from the last descriptor and its GSS chain.
+static void gll_hand_back(GllParser *p, GllDescriptor d, int *top) {
+    int chain = 0;
+    for (int u = d.gss; u != 0; u = GLL_ITEM(p->edges, GssEdge, GLL_ITEM(p->gss, GssNode, u).edges).target) {
+        p->pending = gll_grow(p, p->pending, &p->pending_capacity, sizeof(int), chain + 1);
+        p->pending[chain++] = u;
+    }
+    *top = 0;
+    // The continuation array is read while the stack is rewritten, so they are separate.
+    for (int k = chain - 1; k >= 0; k--) {
+        GssNode node = GLL_ITEM(p->gss, GssNode, p->pending[k]);
+        for (int s = gll_length(p, node.alt) - 1; s >= node.dot; s--) gll_push(p, top, gll_symbol(p, node.alt, s));
+    }
+    for (int s = gll_length(p, d.alt) - 1; s >= d.dot; s--) gll_push(p, top, gll_symbol(p, d.alt, s));
+}
+
+// Marks the forest reachable from the root; returns 1 if some node in it has
+// more than one derivation.
+static int gll_mark_forest(GllParser *p) {
+    int ambiguous = 0, top = 0;
+    if (p->root < 0) return 0;
+    p->seen = gll_grow(p, p->seen, &p->seen_capacity, 1, p->sppf.count);
+    memset(p->seen, 0, p->sppf.count);
+    char *seen = p->seen;
+    p->pending = gll_grow(p, p->pending, &p->pending_capacity, sizeof(int), 1);
+    p->pending[top++] = p->root;
+    seen[p->root] = 1;
+    while (top > 0) {
+        SppfNode *node = &GLL_ITEM(p->sppf, SppfNode, p->pending[--top]);
+        if (node->packed_count > 1) ambiguous = 1;
+        for (int k = node->packed; k != -1; k = GLL_ITEM(p->packed, SppfPacked, k).next) {
+            int children[2] = {GLL_ITEM(p->packed, SppfPacked, k).left, GLL_ITEM(p->packed, SppfPacked, k).right};
+            for (int c = 0; c < 2; c++) {
+                if (children[c] < 0 || seen[children[c]]) continue;
+                seen[children[c]] = 1;
+                p->pending = gll_grow(p, p->pending, &p->pending_capacity, sizeof(int), top + 1);
+                p->pending[top++] = children[c];
+            }
+        }
+    }
+    return ambiguous;
+}
+
+// Runs the engine from the driver stack. Returns 1 if the rest of the input
+// was accepted, 0 if not, and 2 after handing a single remaining path back to
+// the driver (stack and pos updated).
+static int gll_region(GllParser *p, int *input, int count, int *top, int *pos) {
+    int start = *pos;
+    p->cont = gll_grow(p, p->cont, &p->cont_capacity, sizeof(int), *top);
+    for (int i = 0; i < *top; i++) p->cont[i] = p->stack[*top - 1 - i];
+    p->cont_length = *top;
+
+    p->gss.count = p->edges.count = p->pops.count = 0;
+    p->sppf.count = p->packed.count = p->descriptors.count = 0;
+    p->pending_count = 0;
+    gll_hash_reset(p, &p->gss_index);
+    gll_hash_reset(p, &p->edge_index);
+    gll_hash_reset(p, &p->pop_index);
+    gll_hash_reset(p, &p->sppf_index);
+    gll_hash_reset(p, &p->packed_index);
+    gll_hash_reset(p, &p->descriptor_index);
+    int root = gll_alloc(p, &p->gss);
+    GssNode *node = &GLL_ITEM(p->gss, GssNode, root);
+    node->alt = -1;
+    node->dot = 0;
+    node->pos = start;
+    node->edges = -1;
+    node->pops = -1;
+    node->edge_count = 0;
+    p->root = -1;
+    p->regions++;
+
+    int status = -1;
+    gll_add(p, p->ig->alt_count, 0, root, start, -1);
+    while (p->pending_count > 0) {
+        GllDescriptor d = GLL_ITEM(p->descriptors, GllDescriptor, p->pending[--p->pending_count]);
+        if (p->pending_count == 0 && d.pos > start && p->root == -1 && gll_single_path(p, d.gss)) {
+            gll_hand_back(p, d, top);
+            *pos = d.pos;
+            p->handbacks++;
+            status = 2;
+            break;
+        }
+        gll_process(p, input, count, d);
+    }
+    p->descriptor_total += p->descriptors.count;
+    p->gss_total += p->gss.count;
+    p->sppf_total += p->sppf.count;
+    p->packed_total += p->packed.count;
+    if (status == 2) return 2;
+    if (p->root >= 0) {
+        p->ambiguous |= gll_mark_forest(p);
+        return 1;
+    }
+    return 0;
+}
+
+static int gll_drive(GllParser *p, int *input, int count) {
+    int top = 0, pos = 0;
+    gll_push(p, &top, TERMINAL_CODE(p->table->end_column));
+    gll_push(p, &top, p->ig->start);
+
+    while (top > 0) {
+        int sym = p->stack[--top];
+        int col = input[pos];
+        if (col < 0) return -(pos + 1);
+        if (IS_TERMINAL_CODE(sym)) {
+            if (sym - MAX_SYMBOLS != col) return -(pos + 1);
+            pos++;
+            continue;
+        }
+        if (p->conflict[sym][col]) {
+            top++;
+            int status = gll_region(p, input, count, &top, &pos);
+            if (status == 2) continue;
+            return status == 1 ? count : -(p->furthest + 1);
+        }
+        int alt = compressed_table_lookup(p->table, sym, col);
+        if (alt < 0) return -(pos + 1);
+        IndexedAlternative *a = &p->ig->alts[alt];
+        for (int s = a->length - 1; s >= 0; s--) gll_push(p, &top, a->symbols[s]);
+    }
+    return (pos == count) ? pos : -(pos + 1);
+}
+
+void gll_init(GllParser *p, IndexedGrammar *ig, SuffixSets *suffix, ConflictReport *conflicts,
+              CompressedTable *table, size_t memory_limit)
+{
+    memset(p, 0, sizeof(*p));
+    p->ig = ig;
+    p->table = table;
+    p->nullable = suffix->nullable;
+    p->memory_limit = memory_limit;
+    p->gss.size = sizeof(GssNode);
+    p->edges.size = sizeof(GssEdge);
+    p->pops.size = sizeof(GssPop);
+    p->sppf.size = sizeof(SppfNode);
+    p->packed.size = sizeof(SppfPacked);
+    p->descriptors.size = sizeof(GllDescriptor);
+    p->root = -1;
+
+    p->predict = checked_realloc(NULL, (ig->alt_count + 1) * sizeof(TermSet));
+    p->alts_start = checked_realloc(NULL, (ig->non_terminal_count + 1) * sizeof(int));
+    p->alts_list = checked_realloc(NULL, (ig->alt_count + 1) * sizeof(int));
+    for (int i = 0; i <= ig->non_terminal_count; i++) p->alts_start[i] = 0;
+    for (int a = 0; a < ig->alt_count; a++) {
+        int base = suffix->suffix_start[a];
+        p->predict[a] = suffix->suffix_first[base];
+        if (suffix->suffix_nullable[base]) term_set_union(&p->predict[a], &suffix->follow[ig->alts[a].lhs]);
+        p->alts_start[ig->alts[a].lhs + 1]++;
+    }
+    for (int i = 0; i < ig->non_terminal_count; i++) p->alts_start[i + 1] += p->alts_start[i];
+    int fill[MAX_SYMBOLS];
+    memcpy(fill, p->alts_start, sizeof(int) * ig->non_terminal_count);
+    for (int a = 0; a < ig->alt_count; a++) p->alts_list[fill[ig->alts[a].lhs]++] = a;
+    for (int c = 0; c < conflicts->cell_count; c++) {
+        p->conflict[conflicts->cells[c].nt_index][conflicts->cells[c].col] = 1;
+    }
+}
+
+int gll_parse(GllParser *p, int *input, int count) {
+    jmp_buf trap;
+    p->limit_trap = &trap;
+    p->regions = p->handbacks = p->ambiguous = 0;
+    p->descriptor_total = p->gss_total = p->sppf_total = p->packed_total = 0;
+    p->furthest = 0;
+    p->root = -1;
+    if (setjmp(trap)) {
+        p->limit_trap = NULL;
+        p->root = -1;
+        return GLL_LIMIT_EXCEEDED;
+    }
+    int result = gll_drive(p, input, count);
+    p->limit_trap = NULL;
+    return result;
+}
+
+static void sppf_label(Grammar *g, GllParser *p, SppfNode *node, char *buf, size_t size) {
+    int n;
+    if (node->dot >= 0) {
+        // Intermediate node: the slot, with the continuation shown as "..."
+        if (node->label == p->ig->alt_count) {
+            n = snprintf(buf, size, "... .");
+        } else {
+            IndexedAlternative *alt = &p->ig->alts[node->label];
+            n = snprintf(buf, size, "%s ->", g->non_terminals[alt->lhs]);
+            for (int k = 0; k < alt->length && n < (int)size; k++) {
+                n += snprintf(buf + n, size - n, "%s %s", k == node->dot ? " ." : "", symbol_name(g, alt->symbols[k]));
+            }
+            if (node->dot == alt->length && n < (int)size) n += snprintf(buf + n, size - n, " .");
+        }
+    } else if (node->label == GLL_EPSILON_SYMBOL) {
+        n = snprintf(buf, size, "epsilon");
+    } else if (node->label == GLL_CONT_SYMBOL) {
+        n = snprintf(buf, size, "...");
+    } else {
+        n = snprintf(buf, size, "%s", symbol_name(g, node->label));
+    }
+    if (n < (int)size) snprintf(buf + n, size - n, ", %d, %d", node->left, node->right);
+}
+
+// Writes the forest of the last accepted region as a DOT graph: boxes for
+// symbol and intermediate nodes, points for packed nodes.
+void write_sppf_dot(Writer *w, Grammar *g, GllParser *p) {
+    char label[256];
+    writer_str(w, "digraph sppf {\n  node [shape=box];\n");
+    if (p->root >= 0) {
+        gll_mark_forest(p);
+        for (int i = 0; i < p->sppf.count; i++) {
+            if (!p->seen[i]) continue;
+            SppfNode *node = &GLL_ITEM(p->sppf, SppfNode, i);
+            sppf_label(g, p, node, label, sizeof(label));
+            writer_str(w, "  s");
+            writer_int(w, i);
+            writer_str(w, " [label=");
+            writer_quoted(w, label);
+            writer_str(w, node->dot >= 0 ? ", style=rounded];\n" : "];\n");
+            for (int k = node->packed; k != -1; k = GLL_ITEM(p->packed, SppfPacked, k).next) {
+                SppfPacked *packed = &GLL_ITEM(p->packed, SppfPacked, k);
+                writer_str(w, "  p");
+                writer_int(w, k);
+                writer_str(w, " [shape=point];\n  s");
+                writer_int(w, i);
+                writer_str(w, " -> p");
+                writer_int(w, k);
+                writer_str(w, ";\n");
+                int children[2] = {packed->left, packed->right};
+                for (int c = 0; c < 2; c++) {
+                    if (children[c] < 0) continue;
+                    writer_str(w, "  p");
+                    writer_int(w, k);
+                    writer_str(w, " -> s");
+                    writer_int(w, children[c]);
+                    writer_str(w, ";\n");
+                }
+            }
+        }
+    }
+    writer_str(w, "}\n");
+}
+
+void free_gll_parser(GllParser *p) {
+    GllPool *pools[] = {&p->gss, &p->edges, &p->pops, &p->sppf, &p->packed, &p->descriptors};
+    GllHash *indices[] = {&p->gss_index, &p->edge_index, &p->pop_index, &p->sppf_index, &p->packed_index,
+                          &p->descriptor_index};
+    for (int i = 0; i < 6; i++) {
+        free(pools[i]->items);
+        free(indices[i]->slots);
+        free(indices[i]->hashes);
+    }
+    free(p->predict);
+    free(p->alts_start);
+    free(p->alts_list);
+    free(p->stack);
+    free(p->cont);
+    free(p->pending);
+    free(p->seen);
+    memset(p, 0, sizeof(*p));
+}
+
+/*
+   Resident generation server.
+   --serve PATH listens on a Unix domain socket (build with -pthread). A request
+   is one command line ("table", "check", "conflicts" or "shutdown") followed by
+   the grammar text; the client shuts down its write side and reads the reply
+   until EOF. The reply starts with "ok ll1", "ok conflicts" or "error ...".
+   A client that sends nothing for SERVER_READ_TIMEOUT seconds before its EOF
+   gets "error timeout", so idle connections cannot hold the workers.
+   "shutdown" is refused unless the server was started with --allow-shutdown;
+   it then stops the accept loop, which waits for the requests already
+   accepted, removes the socket and returns.
+   Worker threads read requests and answer cache hits concurrently. The pipeline
+   keeps scratch state in statics, so generation itself runs under one lock, on
+   a PassManager whose buffers stay allocated between requests.
+   Replies are cached under the request with whitespace normalized and, one level
+   down, under the grammar left after the transformations, so edits that factor
+   to the same grammar reuse the computed result. Entries keep the whole key
+   text; its hash only skips entries that cannot match.
+*/
+#ifdef __linux__
+#define SERVER_MAX_REQUEST 65536
+#define SERVER_CACHE_SIZE 64
+#define SERVER_QUEUE_SIZE 64
+#define SERVER_READ_TIMEOUT 5
+
+typedef struct {
+    char *key;                  // NULL for an empty slot
+    size_t key_length;
+    unsigned long long hash;
+    char *reply;
+    size_t length;
+    unsigned long last_used;
+} ServerCacheEntry;
+
+static ServerCacheEntry server_cache[SERVER_CACHE_SIZE];
+static unsigned long server_clock;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t generate_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_not_empty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t queue_not_full = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t queue_idle = PTHREAD_COND_INITIALIZER;
+static int client_queue[SERVER_QUEUE_SIZE];
+static int queue_head, queue_count, busy_workers;
+static int server_listener = -1;
+static int server_allow_shutdown, server_stopping;
+
+// Key of the grammar the pipeline actually analyses. The first line cannot
+// be a request's, as "grammar ..." is not a command.
+static char *grammar_key(const char *command, Grammar *g, size_t *length) {
+    char *key = NULL;
+    FILE *out = open_memstream(&key, length);
+    if (!out) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    fprintf(out, "grammar %s\nstart %s\n", command, g->start_symbol);
+    for (int p = 0; p < g->prod_count; p++) {
+        Production *prod = &g->productions[p];
+        fprintf(out, "%s ->", prod->lhs);
+        for (int a = 0; a < prod->rhs_count; a++) {
+            if (a > 0) fprintf(out, " |");
+            for (int k = 0; k < prod->symbols_in_rhs[a]; k++) fprintf(out, " %s", prod->rhs[a][k]);
+        }
+        fprintf(out, "\n");
+    }
+    fclose(out);
+    return key;
+}
+
+static char *copy_bytes(const char *bytes, size_t length) {
+    char *copy = checked_realloc(NULL, length + 1);
+    if (length) memcpy(copy, bytes, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+// Collapses runs of blanks and drops blank lines, so reformatting keeps the key.
+static size_t normalize_grammar_text(char *text) {
+    size_t out = 0;
+    int pending_space = 0;
+    for (size_t i = 0; text[i]; i++) {
+        char c = text[i];
+        if (c == '\n' || c == '\r') {
+            if (out > 0 && text[out - 1] != '\n') text[out++] = '\n';
+            pending_space = 0;
+        } else if (isspace((unsigned char)c)) {
+            pending_space = 1;
+        } else {
+            if (pending_space && out > 0 && text[out - 1] != '\n') text[out++] = ' ';
+            pending_space = 0;
+            text[out++] = c;
+        }
+    }
+    if (out > 0 && text[out - 1] != '\n') text[out++] = '\n';
+    text[out] = '\0';
+    return out;
+}
+
+static int cache_entry_matches(ServerCacheEntry *e, const char *key, size_t key_length, unsigned long long hash) {
+    return e->key && e->hash == hash && e->key_length == key_length && memcmp(e->key, key, key_length) == 0;
+}
+
+// Returns a copy of the reply cached under key, or NULL.
+static char *cache_lookup(const char *key, size_t key_length, size_t *length) {
+    unsigned long long hash = hash_bytes(0xcbf29ce484222325ULL, key, key_length);
+    char *copy = NULL;
+    pthread_mutex_lock(&cache_lock);
+    for (int i = 0; i < SERVER_CACHE_SIZE; i++) {
+        if (cache_entry_matches(&server_cache[i], key, key_length, hash)) {
+            server_cache[i].last_used = ++server_clock;
+            *length = server_cache[i].length;
+            copy = copy_bytes(server_cache[i].reply, *length);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return copy;
+}
+
+// Stores copies of key and reply, replacing the least recently used entry.
+static void cache_store(const char *key, size_t key_length, const char *reply, size_t length) {
+    unsigned long long hash = hash_bytes(0xcbf29ce484222325ULL, key, key_length);
+    pthread_mutex_lock(&cache_lock);
+    int slot = 0;
+    for (int i = 0; i < SERVER_CACHE_SIZE; i++) {
+        if (cache_entry_matches(&server_cache[i], key, key_length, hash)) {
+            slot = i;
+            break;
+        }
+        if (server_cache[i].last_used < server_cache[slot].last_used) slot = i;
+    }
+    ServerCacheEntry *e = &server_cache[slot];
+    free(e->key);
+    free(e->reply);
+    e->key = copy_bytes(key, key_length);
+    e->key_length = key_length;
+    e->hash = hash;
+    e->reply = copy_bytes(reply, length);
+    e->length = length;
+    e->last_used = ++server_clock;
+    pthread_mutex_unlock(&cache_lock);
+}
+
+// Runs the pipeline for one request; called with generate_lock held.
+static char *generate_reply(const char *command, char *text, size_t text_length, size_t *length) {
+    static PassManager pm;
+    static ConflictReport conflicts;
+    static int initialized;
+    char *reply = NULL;
+    FILE *out = open_memstream(&reply, length);
+    if (!out) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    if (!initialized) {
+        pass_manager_init(&pm);
+        initialized = 1;
+    }
+    if (text_length == 0) {
+        fprintf(out, "error empty grammar\n");
+        fclose(out);
+        return reply;
+    }
+
+    jmp_buf trap;
+    FILE *in = fmemopen(text, text_length, "r");
+    capacity_trap = &trap;
+    if (setjmp(trap)) {
+        capacity_trap = NULL;
+        fclose(in);
+        fprintf(out, "error grammar exceeds the maximum number of %s\n", capacity_what);
+        fclose(out);
+        return reply;
+    }
+    pm.grammar = read_grammar(in);
+    pm.valid = 0;
+    run_pass(&pm, &left_factoring_pass, NULL);
+    run_pass(&pm, &left_recursion_pass, NULL);
+    capacity_trap = NULL;
+    fclose(in);
+
+    // Another request may already have produced the same grammar.
+    Grammar *g = &pm.grammar;
+    size_t key_length;
+    char *key = grammar_key(command, g, &key_length);
+    char *cached = cache_lookup(key, key_length, length);
+    if (cached) {
+        free(key);
+        fclose(out);
+        free(reply);
+        return cached;
+    }
+
+    if (strcmp(command, "check") == 0) {
+        require_analyses(&pm, ANALYSIS_FOLLOW);
+        int status = check_ll1(&pm.suffix, NULL);
+        fprintf(out, status == LL1_CHECK_OK ? "ok ll1\n" : "ok conflicts\n");
+    } else if (strcmp(command, "conflicts") == 0) {
+        require_analyses(&pm, ANALYSIS_FOLLOW);
+        int status = check_ll1(&pm.suffix, &conflicts);
+        fprintf(out, status == LL1_CHECK_OK ? "ok ll1\n" : "ok conflicts\n");
+        write_conflict_report_json(out, g, &pm.suffix, &conflicts);
+    } else if (strcmp(command, "table") == 0) {
+        // One line per filled cell: non-terminal, terminal and alternative.
+        require_analyses(&pm, ANALYSIS_TABLE);
+        fprintf(out, pm.conflicts.cell_count == 0 ? "ok ll1\n" : "ok conflicts\n");
+        for (int i = 0; i < g->non_terminal_count; i++) {
+            for (int col = 0; col <= g->terminal_count; col++) {
+                int code = pm.parsing_table[i][col];
+                if (code == -1) continue;
+                Production *prod = &g->productions[code / 1000];
+                int altIndex = code % 1000;
+                fprintf(out, "%s\t%s\t%s ->", g->non_terminals[i], column_name(g, col), prod->lhs);
+                for (int k = 0; k < prod->symbols_in_rhs[altIndex]; k++) fprintf(out, " %s", prod->rhs[altIndex][k]);
+                fprintf(out, "\n");
+            }
+        }
+    } else {
+        fprintf(out, "error unknown command %s\n", command);
+        free(key);
+        fclose(out);
+        return reply;
+    }
+    fclose(out);
+    cache_store(key, key_length, reply, *length);
+    free(key);
+    return reply;
+}
+
+static void write_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t n = write(fd, data, length);
+        if (n <= 0) return;
+        data += n;
+        length -= n;
+    }
+}
+
+static void serve_client(int fd, char *buffer) {
+    size_t used = 0;
+    ssize_t n;
+    while (used < SERVER_MAX_REQUEST && (n = read(fd, buffer + used, SERVER_MAX_REQUEST - used)) > 0) {
+        used += n;
+    }
+    if (used < SERVER_MAX_REQUEST && n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        const char *message = "error timeout\n";
+        write_all(fd, message, strlen(message));
+        return;
+    }
+    if (used == SERVER_MAX_REQUEST) {
+        const char *message = "error request too large\n";
+        write_all(fd, message, strlen(message));
+        return;
+    }
+    buffer[used] = '\0';
+
+    // First line is the command, the rest is the grammar.
+    char *command = buffer;
+    char *text = strchr(buffer, '\n');
+    if (text) *text++ = '\0';
+    else text = buffer + used;
+    command[strcspn(command, "\r")] = '\0';
+    if (strcmp(command, "shutdown") == 0) {
+        if (!server_allow_shutdown) {
+            const char *message = "error shutdown is not enabled on this server\n";
+            write_all(fd, message, strlen(message));
+            return;
+        }
+        const char *message = "ok shutdown\n";
+        write_all(fd, message, strlen(message));
+        pthread_mutex_lock(&queue_lock);
+        server_stopping = 1;
+        pthread_mutex_unlock(&queue_lock);
+        // Wakes the accept loop, which stops the server
+        shutdown(server_listener, SHUT_RDWR);
+        return;
+    }
+    size_t text_length = normalize_grammar_text(text);
+
+    // The key is the command line and the normalized text
+    size_t command_length = strlen(command);
+    size_t key_length = command_length + 1 + text_length;
+    char *key = checked_realloc(NULL, key_length + 1);
+    memcpy(key, command, command_length);
+    key[command_length] = '\n';
+    memcpy(key + command_length + 1, text, text_length + 1);
+
+    size_t length;
+    char *reply = cache_lookup(key, key_length, &length);
+    if (!reply) {
+        pthread_mutex_lock(&generate_lock);
+        reply = generate_reply(command, text, text_length, &length);
+        pthread_mutex_unlock(&generate_lock);
+        if (reply && strncmp(reply, "ok", 2) == 0) cache_store(key, key_length, reply, length);
+    }
+    if (reply) write_all(fd, reply, length);
+    free(reply);
+    free(key);
+}
+
+static void *server_worker(void *arg) {
+    char *buffer = checked_realloc(NULL, SERVER_MAX_REQUEST + 1);
+    (void)arg;
+    while (1) {
+        pthread_mutex_lock(&queue_lock);
+        while (queue_count == 0) pthread_cond_wait(&queue_not_empty, &queue_lock);
+        int fd = client_queue[queue_head];
+        queue_head = (queue_head + 1) % SERVER_QUEUE_SIZE;
+        queue_count--;
+        busy_workers++;
+        pthread_cond_signal(&queue_not_full);
+        pthread_mutex_unlock(&queue_lock);
+
+        serve_client(fd, buffer);
+        close(fd);
+        pthread_mutex_lock(&queue_lock);
+        if (--busy_workers == 0 && queue_count == 0) pthread_cond_signal(&queue_idle);
+        pthread_mutex_unlock(&queue_lock);
+    }
+    return NULL;
+}
+
+int serve_grammars(const char *path, int threads, int allow_shutdown) {
+    struct sockaddr_un addr;
+    if (threads < 1) threads = 1;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        printf("Socket path too long\n");
+        return 1;
+    }
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if (listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(listener, SERVER_QUEUE_SIZE) != 0) {
+        printf("Error opening socket %s\n", path);
+        return 1;
+    }
+    server_listener = listener;
+    server_allow_shutdown = allow_shutdown;
+    // Clients that disconnect early must not kill the server.
+    signal(SIGPIPE, SIG_IGN);
+
+    for (int i = 0; i < threads; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, server_worker, NULL) != 0) {
+            printf("Error starting worker threads\n");
+            return 1;
+        }
+        pthread_detach(thread);
+    }
+    printf("Serving grammars on %s with %d threads\n", path, threads);
+    fflush(stdout);
+
+    while (1) {
+        int fd = accept(listener, NULL, NULL);
+        if (fd >= 0) {
+            struct timeval timeout = {SERVER_READ_TIMEOUT, 0};
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        }
+        pthread_mutex_lock(&queue_lock);
+        if (server_stopping) {
+            pthread_mutex_unlock(&queue_lock);
+            if (fd >= 0) close(fd);
+            break;
+        }
+        if (fd < 0) {
+            pthread_mutex_unlock(&queue_lock);
+            continue;
+        }
+        while (queue_count == SERVER_QUEUE_SIZE) pthread_cond_wait(&queue_not_full, &queue_lock);
+        client_queue[(queue_head + queue_count) % SERVER_QUEUE_SIZE] = fd;
+        queue_count++;
+        pthread_cond_signal(&queue_not_empty);
+        pthread_mutex_unlock(&queue_lock);
+    }
+
+    // Let the workers answer what was accepted before the shutdown request
+    pthread_mutex_lock(&queue_lock);
+    while (queue_count > 0 || busy_workers > 0) pthread_cond_wait(&queue_idle, &queue_lock);
+    pthread_mutex_unlock(&queue_lock);
+    close(listener);
+    unlink(path);
+    printf("Server on %s stopped\n", path);
+    return 0;
+}
+
+// Sends the grammar file to a server and prints the reply; the exit status is
+// 0 for an LL(1) grammar, as with --check.
+int request_from_server(const char *path, const char *command, const char *grammar_file) {
+    struct sockaddr_un addr;
+    char buffer[4096];
+    size_t n;
+    FILE *file = NULL;
+    if (strcmp(command, "shutdown") != 0) {
+        file = fopen(grammar_file, "r");
+        if (!file) {
+            printf("Error opening file\n");
+            return 1;
+        }
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        printf("Error connecting to %s\n", path);
+        if (file) fclose(file);
+        return 1;
+    }
+    write_all(fd, command, strlen(command));
+    write_all(fd, "\n", 1);
+    while (file && (n = fread(buffer, 1, sizeof(buffer), file)) > 0) write_all(fd, buffer, n);
+    if (file) fclose(file);
+    shutdown(fd, SHUT_WR);
+
+    int status = -1;
+    ssize_t got;
+    while ((got = read(fd, buffer, sizeof(buffer))) > 0) {
+        if (status == -1) status = strncmp(buffer, "ok ll1", 6) == 0 || strncmp(buffer, "ok shutdown", 11) == 0 ? 0 : 1;
+        fwrite(buffer, 1, got, stdout);
+    }
+    close(fd);
+    return status == 0 ? 0 : 1;
+}
+#else
+int serve_grammars(const char *path, int threads, int allow_shutdown) {
+    (void)path;
+    (void)threads;
+    (void)allow_shutdown;
+    printf("Server mode needs Unix domain sockets\n");
+    return 1;
+}
+
+int request_from_server(const char *path, const char *command, const char *grammar_file) {
+    (void)path;
+    (void)command;
+    (void)grammar_file;
+    printf("Server mode needs Unix domain sockets\n");
+    return 1;
+}
+#endif
+
+#ifdef FUZZ_HARNESS
+/*
+   Fuzz and differential-testing harness for the generation pipeline.
+   Build it in place of the normal main():
+       gcc -O2 -DFUZZ_HARNESS -o fuzz compiler.c
+   (nightly jobs should add -fsanitize=address,undefined so that overruns the
+   capacity checks miss still abort). Each random grammar goes through
+   left_factoring, remove_left_recursion, compute_first_sets,
+   compute_follow_sets and construct_parsing_table, and is checked against:
+   - array bounds of every intermediate Grammar,
+   - FIRST/FOLLOW sets computed by a separate closure-based reference,
+   - the table and conflict report implied by the reference predict sets,
+   - check_ll1, which must find the same conflicts without the table,
+   - the GLL hybrid, which must agree with Earley on sampled and mutated input,
+   - incremental reparsing, which must match a full parse after random edits,
+   - a table laid out from a random profile, which must parse like the original,
+   - every fourth iteration, a random chain of operator levels, which the
+     precedence climber must parse exactly like the table driver,
+   - sampled sentences, which an Earley recognizer must accept in both the
+     original and the transformed grammar.
+   Every --oversize grammar exceeds one MAX_* limit and must raise capacity_error,
+   while the grammars in limit_grammars, which reach a limit exactly, must not.
+*/
+#define FUZZ_MAX_SAMPLE 32
+#define FUZZ_MAX_ITEMS 4096
+
+typedef struct {
+    int max_non_terminals;
+    int max_terminals;
+    int max_alternatives;
+    int max_length;
+    int samples;
+} FuzzLimits;
+
+typedef struct {
+    char nullable[MAX_SYMBOLS];
+    char first[MAX_SYMBOLS][MAX_SYMBOLS + 1];
+    char follow[MAX_SYMBOLS][MAX_SYMBOLS + 1];
+} ReferenceSets;
+
+typedef struct {
+    short alt;
+    short dot;
+    short origin;
+} EarleyItem;
+
+static unsigned long long fuzz_state = 88172645463325252ULL;
+static long fuzz_failures = 0;
+
+static unsigned fuzz_rand(unsigned n) {
+    fuzz_state ^= fuzz_state << 13;
+    fuzz_state ^= fuzz_state >> 7;
+    fuzz_state ^= fuzz_state << 17;
+    return (unsigned)(fuzz_state % n);
+}
+
+static void fuzz_symbol_name(char *out, int upper, int index) {
+    if (index < 26) sprintf(out, "%c", (upper ? 'A' : 'a') + index);
+    else sprintf(out, "%c%d", (upper ? 'A' : 'a') + index % 26, index / 26);
+}
+
+// Writes a random grammar in the input file format. oversize selects a MAX_*
+// limit to exceed (0 for none).
+static void generate_grammar(FuzzLimits *limits, int oversize, char *text, size_t size) {
+    int nts = 1 + fuzz_rand(limits->max_non_terminals);
+    int terminals = 1 + fuzz_rand(limits->max_terminals);
+    size_t len = 0;
+    char name[32];
+
+    for (int i = 0; i < nts; i++) {
+        fuzz_symbol_name(name, 1, i);
+        len += snprintf(text + len, size - len, "%s ->", name);
+        int alts = 1 + fuzz_rand(limits->max_alternatives);
+        if (oversize == 1 && i == 0) alts = MAX_RHS + 1;
+        int has_epsilon = 0;
+        for (int a = 0; a < alts; a++) {
+            int symbols = fuzz_rand(limits->max_length + 1);
+            if (oversize == 2 && i == 0 && a == 0) symbols = MAX_SYMBOL_LENGTH + 1;
+            if (a > 0) len += snprintf(text + len, size - len, " |");
+            if (symbols == 0 && !has_epsilon) {
+                has_epsilon = 1;
+                len += snprintf(text + len, size - len, " epsilon");
+                continue;
+            }
+            if (symbols == 0) symbols = 1;
+            for (int s = 0; s < symbols; s++) {
+                if (fuzz_rand(3) == 0) fuzz_symbol_name(name, 1, fuzz_rand(nts));
+                else fuzz_symbol_name(name, 0, fuzz_rand(terminals));
+                len += snprintf(text + len, size - len, " %s", name);
+            }
+        }
+        if (oversize == 3 && i == 0) len += snprintf(text + len, size - len, " | averylongterminal");
+        len += snprintf(text + len, size - len, "\n");
+    }
+    if (oversize == 4) {
+        // More terminals than the FIRST/FOLLOW sets can hold.
+        len += snprintf(text + len, size - len, "A ->");
+        for (int t = 0; t < MAX_SYMBOLS; t++) {
+            if (len + 16 >= size) break;
+            fuzz_symbol_name(name, 0, t);
+            len += snprintf(text + len, size - len, " %s", name);
+            if (t % 8 == 7) len += snprintf(text + len, size - len, " |");
+        }
+        len += snprintf(text + len, size - len, " z\n");
+    }
+}
+
+static int grammar_within_bounds(Grammar *g) {
+    if (g->prod_count < 0 || g->prod_count > MAX_PRODUCTIONS) return 0;
+    if (g->non_terminal_count < 0 || g->non_terminal_count > MAX_SYMBOLS) return 0;
+    if (g->terminal_count < 0 || g->terminal_count > MAX_SYMBOLS - 2) return 0;
+    if (!memchr(g->start_symbol, '\0', MAX_SYMBOL_LENGTH)) return 0;
+    for (int i = 0; i < g->non_terminal_count; i++) {
+        if (!memchr(g->non_terminals[i], '\0', MAX_SYMBOL_LENGTH)) return 0;
+    }
+    for (int i = 0; i < g->terminal_count; i++) {
+        if (!memchr(g->terminals[i], '\0', MAX_SYMBOL_LENGTH)) return 0;
+    }
+    for (int p = 0; p < g->prod_count; p++) {
+        Production *prod = &g->productions[p];
+        if (!memchr(prod->lhs, '\0', MAX_SYMBOL_LENGTH)) return 0;
+        if (prod->rhs_count < 0 || prod->rhs_count > MAX_RHS) return 0;
+        for (int a = 0; a < prod->rhs_count; a++) {
+            if (prod->symbols_in_rhs[a] < 0 || prod->symbols_in_rhs[a] > MAX_SYMBOL_LENGTH) return 0;
+            for (int s = 0; s < prod->symbols_in_rhs[a]; s++) {
+                if (!memchr(prod->rhs[a][s], '\0', MAX_SYMBOL_LENGTH)) return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+static void warshall(char reach[MAX_SYMBOLS][MAX_SYMBOLS], int n) {
+    for (int k = 0; k < n; k++)
+        for (int i = 0; i < n; i++)
+            if (reach[i][k])
+                for (int j = 0; j < n; j++)
+                    if (reach[k][j]) reach[i][j] = 1;
+}
+
+// Reference FIRST/FOLLOW from the closure of the "begins with" and
+// "is followed by" relations, independent of the fixed-point code under test.
+static void reference_sets(IndexedGrammar *ig, ReferenceSets *r) {
+    static char begins[MAX_SYMBOLS][MAX_SYMBOLS];
+    static char ends[MAX_SYMBOLS][MAX_SYMBOLS];
+    static char direct[MAX_SYMBOLS][MAX_SYMBOLS + 1];
+    static char follow_direct[MAX_SYMBOLS][MAX_SYMBOLS + 1];
+    int n = ig->non_terminal_count;
+    int columns = ig->terminal_count + 1;
+
+    memset(r, 0, sizeof(*r));
+    memset(begins, 0, sizeof(begins));
+    memset(ends, 0, sizeof(ends));
+    memset(direct, 0, sizeof(direct));
+    memset(follow_direct, 0, sizeof(follow_direct));
+
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int i = 0; i < ig->alt_count; i++) {
+            IndexedAlternative *alt = &ig->alts[i];
+            int all = 1;
+            for (int s = 0; s < alt->length && all; s++) {
+                if (IS_TERMINAL_CODE(alt->symbols[s]) || !r->nullable[alt->symbols[s]]) all = 0;
+            }
+            if (all && !r->nullable[alt->lhs]) {
+                r->nullable[alt->lhs] = 1;
+                changed = 1;
+            }
+        }
+    }
+
+    for (int i = 0; i < n; i++) begins[i][i] = ends[i][i] = 1;
+    for (int i = 0; i < ig->alt_count; i++) {
+        IndexedAlternative *alt = &ig->alts[i];
+        for (int s = 0; s < alt->length; s++) {
+            int sym = alt->symbols[s];
+            if (IS_TERMINAL_CODE(sym)) {
+                direct[alt->lhs][sym - MAX_SYMBOLS] = 1;
+                break;
+            }
+            begins[alt->lhs][sym] = 1;
+            if (!r->nullable[sym]) break;
+        }
+    }
+    warshall(begins, n);
+    for (int a = 0; a < n; a++)
+        for (int b = 0; b < n; b++)
+            if (begins[a][b])
+                for (int t = 0; t < columns; t++)
+                    if (direct[b][t]) r->first[a][t] = 1;
+
+    if (ig->start >= 0) follow_direct[ig->start][ig->terminal_count] = 1;
+    for (int i = 0; i < ig->alt_count; i++) {
+        IndexedAlternative *alt = &ig->alts[i];
+        for (int s = 0; s < alt->length; s++) {
+            int b = alt->symbols[s];
+            if (IS_TERMINAL_CODE(b)) continue;
+            int tail_nullable = 1;
+            for (int u = s + 1; u < alt->length && tail_nullable; u++) {
+                int sym = alt->symbols[u];
+                if (IS_TERMINAL_CODE(sym)) {
+                    follow_direct[b][sym - MAX_SYMBOLS] = 1;
+                    tail_nullable = 0;
+                } else {
+                    for (int t = 0; t < columns; t++)
+                        if (r->first[sym][t]) follow_direct[b][t] = 1;
+                    tail_nullable = r->nullable[sym];
+                }
+            }
+            if (tail_nullable) ends[b][alt->lhs] = 1;
+        }
+    }
+    warshall(ends, n);
+    for (int a = 0; a < n; a++)
+        for (int b = 0; b < n; b++)
+            if (ends[a][b])
+                for (int t = 0; t < columns; t++)
+                    if (follow_direct[b][t]) r->follow[a][t] = 1;
+}
+
+static int predicts(IndexedGrammar *ig, ReferenceSets *r, IndexedAlternative *alt, int col) {
+    for (int s = 0; s < alt->length; s++) {
+        int sym = alt->symbols[s];
+        if (IS_TERMINAL_CODE(sym)) return sym - MAX_SYMBOLS == col;
+        if (r->first[sym][col]) return 1;
+        if (!r->nullable[sym]) return 0;
+    }
+    (void)ig;
+    return r->follow[alt->lhs][col];
+}
+
+// Compares a string set produced by the pipeline with a reference row.
+static int same_set(Grammar *g, char set[MAX_SYMBOLS][MAX_SYMBOL_LENGTH], int count,
+                    char expected[MAX_SYMBOLS + 1], int expected_epsilon)
+{
+    char seen[MAX_SYMBOLS + 1] = {0};
+    int epsilon = 0;
+    for (int i = 0; i < count; i++) {
+        if (strcmp(set[i], "epsilon") == 0) {
+            epsilon = 1;
+            continue;
+        }
+        int code = get_symbol_code(g, set[i]);
+        if (code == -1 || !IS_TERMINAL_CODE(code)) return 0;
+        seen[code - MAX_SYMBOLS] = 1;
+    }
+    if (epsilon != expected_epsilon) return 0;
+    for (int t = 0; t <= g->terminal_count; t++) {
+        if (seen[t] != expected[t]) return 0;
+    }
+    return 1;
+}
+
+// Earley recognizer, used as the oracle for language preservation.
+static int earley_accepts(IndexedGrammar *ig, char nullable[MAX_SYMBOLS], int *tokens, int n) {
+    static EarleyItem sets[FUZZ_MAX_SAMPLE + 1][FUZZ_MAX_ITEMS];
+    static unsigned stamp[MAX_ALTERNATIVES * (MAX_SYMBOL_LENGTH + 1) * (FUZZ_MAX_SAMPLE + 1)];
+    static unsigned generation = 0;
+    int size[FUZZ_MAX_SAMPLE + 1];
+    unsigned set_stamp[FUZZ_MAX_SAMPLE + 1];
+
+    if (ig->start < 0) return 0;
+    for (int i = 0; i <= n; i++) {
+        size[i] = 0;
+        set_stamp[i] = ++generation;
+        if (generation == 0) {
+            memset(stamp, 0, sizeof(stamp));
+            set_stamp[i] = generation = 1;
+        }
+    }
+
+#define EARLEY_ADD(set, a, d, o) do { \
+        unsigned key = ((unsigned)(a) * (MAX_SYMBOL_LENGTH + 1) + (d)) * (FUZZ_MAX_SAMPLE + 1) + (o); \
+        if (stamp[key] != set_stamp[set]) { \
+            if (size[set] == FUZZ_MAX_ITEMS) return -1; \
+            stamp[key] = set_stamp[set]; \
+            sets[set][size[set]].alt = (short)(a); \
+            sets[set][size[set]].dot = (short)(d); \
+            sets[set][size[set]].origin = (short)(o); \
+            size[set]++; \
+        } \
+    } while (0)
+
+    for (int a = 0; a < ig->alt_count; a++) {
+        if (ig->alts[a].lhs == ig->start) EARLEY_ADD(0, a, 0, 0);
+    }
+    for (int i = 0; i <= n; i++) {
+        for (int k = 0; k < size[i]; k++) {
+            EarleyItem item = sets[i][k];
+            IndexedAlternative *alt = &ig->alts[item.alt];
+            if (item.dot < alt->length) {
+                int sym = alt->symbols[item.dot];
+                if (IS_TERMINAL_CODE(sym)) {
+                    if (i < n && tokens[i] == sym - MAX_SYMBOLS) EARLEY_ADD(i + 1, item.alt, item.dot + 1, item.origin);
+                } else {
+                    for (int a = 0; a < ig->alt_count; a++) {
+                        if (ig->alts[a].lhs == sym) EARLEY_ADD(i, a, 0, i);
+                    }
+                    if (nullable[sym]) EARLEY_ADD(i, item.alt, item.dot + 1, item.origin);
+                }
+            } else {
+                for (int j = 0; j < size[item.origin]; j++) {
+                    EarleyItem waiting = sets[item.origin][j];
+                    IndexedAlternative *w = &ig->alts[waiting.alt];
+                    if (waiting.dot < w->length && w->symbols[waiting.dot] == alt->lhs) {
+                        EARLEY_ADD(i, waiting.alt, waiting.dot + 1, waiting.origin);
+                    }
+                }
+            }
+        }
+    }
+#undef EARLEY_ADD
+
+    for (int k = 0; k < size[n]; k++) {
+        EarleyItem item = sets[n][k];
+        if (item.origin == 0 && ig->alts[item.alt].lhs == ig->start && item.dot == ig->alts[item.alt].length) return 1;
+    }
+    return 0;
+}
+
+// Random sentence of the grammar; returns its length or -1 if it grew too long.
+static int sample_symbol(IndexedGrammar *ig, int height[MAX_SYMBOLS], int sym, int depth, int *out, int len) {
+    if (IS_TERMINAL_CODE(sym)) {
+        if (len == FUZZ_MAX_SAMPLE) return -1;
+        out[len] = sym - MAX_SYMBOLS;
+        return len + 1;
+    }
+    int choices[MAX_ALTERNATIVES];
+    int count = 0, best = -1, best_height = 1 << 30;
+    for (int a = 0; a < ig->alt_count; a++) {
+        IndexedAlternative *alt = &ig->alts[a];
+        if (alt->lhs != sym) continue;
+        int h = 0;
+        for (int s = 0; s < alt->length; s++) {
+            if (!IS_TERMINAL_CODE(alt->symbols[s]) && height[alt->symbols[s]] > h) h = height[alt->symbols[s]];
+        }
+        if (h == 1 << 30) continue;
+        choices[count++] = a;
+        if (h < best_height) {
+            best_height = h;
+            best = a;
+        }
+    }
+    if (count == 0) return -1;
+    // Past the depth limit, take the alternative closest to terminals.
+    int a = (depth > 8) ? best : choices[fuzz_rand(count)];
+    for (int s = 0; s < ig->alts[a].length && len >= 0; s++) {
+        len = sample_symbol(ig, height, ig->alts[a].symbols[s], depth + 1, out, len);
+    }
+    return len;
+}
+
+static void derivation_heights(IndexedGrammar *ig, int height[MAX_SYMBOLS]) {
+    for (int i = 0; i < ig->non_terminal_count; i++) height[i] = 1 << 30;
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int a = 0; a < ig->alt_count; a++) {
+            IndexedAlternative *alt = &ig->alts[a];
+            int h = 0;
+            for (int s = 0; s < alt->length; s++) {
+                if (!IS_TERMINAL_CODE(alt->symbols[s]) && height[alt->symbols[s]] > h) h = height[alt->symbols[s]];
+            }
+            if (h != 1 << 30 && h + 1 < height[alt->lhs]) {
+                height[alt->lhs] = h + 1;
+                changed = 1;
+            }
+        }
+    }
+}
+
+// Checks that sentences sampled from one grammar are sentences of the other.
+static int sentences_preserved(Grammar *from_g, IndexedGrammar *from, Grammar *to_g, IndexedGrammar *to,
+                               ReferenceSets *to_sets, int samples)
+{
+    int height[MAX_SYMBOLS];
+    int sentence[FUZZ_MAX_SAMPLE], mapped[FUZZ_MAX_SAMPLE];
+    if (from->start < 0) return 1;
+    derivation_heights(from, height);
+    if (height[from->start] == 1 << 30) return 1;
+
+    for (int i = 0; i < samples; i++) {
+        int len = sample_symbol(from, height, from->start, 0, sentence, 0);
+        if (len < 0) continue;
+        for (int t = 0; t < len; t++) {
+            int code = get_symbol_code(to_g, from_g->terminals[sentence[t]]);
+            if (code == -1 || !IS_TERMINAL_CODE(code)) return 0;
+            mapped[t] = code - MAX_SYMBOLS;
+        }
+        if (earley_accepts(to, to_sets->nullable, mapped, len) == 0) return 0;
+    }
+    return 1;
+}
+
+// Whether the grammar has sentences sample_and_check can draw
+static int samplable(Grammar *g, IndexedGrammar *ig) {
+    int height[MAX_SYMBOLS];
+    if (ig->start < 0 || g->terminal_count == 0) return 0;
+    derivation_heights(ig, height);
+    return height[ig->start] != 1 << 30;
+}
+
+// Check of one sentence with the end column at sentence[len]; returns 0 on a
+// disagreement.
+typedef int (*SentenceCheck)(void *context, int *sentence, int len);
+
+// Runs check on sampled sentences of a samplable grammar and, if mutate is
+// set, on a copy of each with one token replaced; stops at the first failure.
+static int sample_and_check(Grammar *g, IndexedGrammar *ig, int samples, int mutate, SentenceCheck check,
+                            void *context)
+{
+    int height[MAX_SYMBOLS];
+    int sentence[FUZZ_MAX_SAMPLE + 1];
+    derivation_heights(ig, height);
+    int ok = 1;
+    for (int i = 0; i < samples && ok; i++) {
+        int len = sample_symbol(ig, height, ig->start, 0, sentence, 0);
+        if (len < 0) continue;
+        for (int mutated = 0; mutated <= mutate && ok; mutated++) {
+            if (mutated && len > 0) sentence[fuzz_rand(len)] = fuzz_rand(g->terminal_count);
+            sentence[len] = g->terminal_count;
+            ok = check(context, sentence, len);
+        }
+    }
+    return ok;
+}
+
+typedef struct {
+    GllParser *gll;
+    IndexedGrammar *ig;
+    ReferenceSets *sets;
+} GllCheck;
+
+static int gll_check(void *context, int *sentence, int len) {
+    GllCheck *c = context;
+    int result = gll_parse(c->gll, sentence, len + 1);
+    if (result == GLL_LIMIT_EXCEEDED) return 1;
+    return (result >= 0) == (earley_accepts(c->ig, c->sets->nullable, sentence, len) != 0);
+}
+
+// The GLL hybrid must agree with Earley on sampled sentences and on copies
+// with one token replaced, whether or not the table has conflicts.
+static int gll_agrees(Grammar *g, IndexedGrammar *ig, ReferenceSets *sets, SuffixSets *suffix,
+                      ConflictReport *conflicts, int parsing_table[MAX_SYMBOLS][MAX_SYMBOLS], int samples)
+{
+    static GllParser gll;
+    if (!samplable(g, ig)) return 1;
+
+    CompressedTable packed;
+    build_compressed_table(g, ig, parsing_table, 1, &packed);
+    gll_init(&gll, ig, suffix, conflicts, &packed, (size_t)64 << 20);
+    GllCheck check = {&gll, ig, sets};
+    int ok = sample_and_check(g, ig, samples, 1, gll_check, &check);
+    free_gll_parser(&gll);
+    free_compressed_table(&packed);
+    return ok;
+}
+
+typedef struct {
+    Grammar *g;
+    IndexedGrammar *ig;
+    CompressedTable *packed;
+    int height[MAX_SYMBOLS];
+} IncrementalCheck;
+
+// Applies random edits to the sentence incrementally and compares every step
+// with a parse of the edited input from scratch.
+static int incremental_check(void *context, int *sentence, int len) {
+    static IncrementalParse doc, fresh;
+    IncrementalCheck *c = context;
+    IndexedGrammar *ig = c->ig;
+    int tokens[4 * FUZZ_MAX_SAMPLE + 1], inserted[FUZZ_MAX_SAMPLE], undo[FUZZ_MAX_SAMPLE];
+    memcpy(tokens, sentence, (len + 1) * sizeof(int));
+    incremental_parse(&doc, ig, c->packed, tokens, len + 1, 1 + fuzz_rand(4));
+    int ok = 1;
+    int undo_start = -1, undo_removed = 0, undo_count = 0;
+    for (int edit = 0; edit < 6 && ok; edit++) {
+        // Undo the previous edit, so that a rejection gets fixed again, or insert
+        // a sampled sentence or a few random tokens in place of up to three
+        int start, removed, count;
+        if (undo_start >= 0 && fuzz_rand(2)) {
+            start = undo_start;
+            removed = undo_removed;
+            count = undo_count;
+            memcpy(inserted, undo, count * sizeof(int));
+        } else {
+            start = fuzz_rand(len + 1);
+            removed = fuzz_rand(len - start + 1);
+            if (removed > 3) removed = 3;
+            count = fuzz_rand(2) ? sample_symbol(ig, c->height, ig->start, 0, inserted, 0) : -1;
+            if (count < 0) {
+                count = fuzz_rand(3);
+                for (int k = 0; k < count; k++) inserted[k] = fuzz_rand(c->g->terminal_count);
+            }
+        }
+        if (len - removed + count > 4 * FUZZ_MAX_SAMPLE) continue;
+        undo_start = start;
+        undo_removed = count;
+        undo_count = removed;
+        memcpy(undo, tokens + start, removed * sizeof(int));
+        memmove(tokens + start + count, tokens + start + removed, (len + 1 - start - removed) * sizeof(int));
+        memcpy(tokens + start, inserted, count * sizeof(int));
+        len += count - removed;
+
+        int result = incremental_edit(&doc, start, removed, inserted, count);
+        int expected = incremental_parse(&fresh, ig, c->packed, tokens, len + 1, 1 + fuzz_rand(4));
+        int *a, *b;
+        int a_count = incremental_derivation(&doc, &a), b_count = incremental_derivation(&fresh, &b);
+        ok = result == expected && result == ll1_parse(ig, c->packed, tokens, len + 1, NULL) && a_count == b_count &&
+             memcmp(a, b, a_count * sizeof(int)) == 0;
+        free(a);
+        free(b);
+        free_incremental_parse(&fresh);
+    }
+    free_incremental_parse(&doc);
+    return ok;
+}
+
+// Random edits applied incrementally must give the same result and derivation
+// as parsing the edited input from scratch (for conflict-free tables, where the
+// driver is guaranteed to terminate).
+static int incremental_agrees(Grammar *g, IndexedGrammar *ig, int parsing_table[MAX_SYMBOLS][MAX_SYMBOLS],
+                              int samples)
+{
+    static IncrementalCheck check;
+    if (!samplable(g, ig)) return 1;
+
+    CompressedTable packed;
+    build_compressed_table(g, ig, parsing_table, 1, &packed);
+    check.g = g;
+    check.ig = ig;
+    check.packed = &packed;
+    derivation_heights(ig, check.height);
+    int ok = sample_and_check(g, ig, samples, 0, incremental_check, &check);
+    free_compressed_table(&packed);
+    return ok;
+}
+
+typedef struct {
+    IndexedGrammar *ig;
+    CompressedTable *packed;
+    ProfiledTable *profiled;
+} ProfiledCheck;
+
+static int profiled_check(void *context, int *sentence, int len) {
+    ProfiledCheck *c = context;
+    return profiled_parse(c->profiled, sentence, len + 1) == ll1_parse(c->ig, c->packed, sentence, len + 1, NULL);
+}
+
+// A layout built from a random profile must parse sampled and mutated
+// sentences exactly like the compressed table.
+static int profiled_agrees(Grammar *g, IndexedGrammar *ig, int parsing_table[MAX_SYMBOLS][MAX_SYMBOLS],
+                           int samples)
+{
+    static ParseProfile profile;
+    if (!samplable(g, ig)) return 1;
+
+    for (int nt = 0; nt < g->non_terminal_count; nt++) {
+        for (int col = 0; col <= g->terminal_count; col++) profile.cell[nt][col] = fuzz_rand(4) ? 0 : fuzz_rand(1000);
+    }
+    CompressedTable packed;
+    ProfiledTable profiled;
+    build_compressed_table(g, ig, parsing_table, 1, &packed);
+    build_profiled_table(ig, &packed, &profile, &profiled);
+    ProfiledCheck check = {ig, &packed, &profiled};
+    int ok = sample_and_check(g, ig, samples, 1, profiled_check, &check);
+    free_profiled_table(&profiled);
+    free_compressed_table(&packed);
+    return ok;
+}
+
+// A grammar with operator levels, transformed, with its table and the levels
+// resolved against it
+typedef struct {
+    Grammar original, transformed;
+    IndexedGrammar ig_original, ig_transformed;
+    OperatorLevels levels;
+    PrattTable pt;
+    CompressedTable packed;
+} PrattFixture;
+
+// Returns 0 if the transformed grammar has conflicts; otherwise the caller
+// frees f->packed.
+static int pratt_fixture(PrattFixture *f, char *text) {
+    static char first_sets[MAX_SYMBOLS][MAX_SYMBOLS][MAX_SYMBOL_LENGTH];
+    static char follow_sets[MAX_SYMBOLS][MAX_SYMBOLS][MAX_SYMBOL_LENGTH];
+    static int parsing_table[MAX_SYMBOLS][MAX_SYMBOLS];
+    static ConflictReport conflicts;
+    static SuffixSets suffix;
+    int first_count[MAX_SYMBOLS], follow_count[MAX_SYMBOLS];
+
+    FILE *in = fmemopen(text, strlen(text), "r");
+    f->original = read_grammar(in);
+    rewind(in);
+    read_operator_levels(in, &f->levels);
+    fclose(in);
+    check_operator_levels(&f->original, &f->levels);
+    f->transformed = remove_left_recursion(left_factoring(f->original));
+    index_grammar(&f->original, &f->ig_original);
+    index_grammar(&f->transformed, &f->ig_transformed);
+    compute_first_sets(&f->transformed, first_sets, first_count);
+    compute_suffix_sets(&f->transformed, &f->ig_transformed, first_sets, first_count, &suffix);
+    compute_follow_sets(&f->transformed, &suffix, follow_sets, follow_count);
+    construct_parsing_table(&f->transformed, &suffix, parsing_table, &conflicts);
+    if (conflicts.cell_count) return 0;
+    build_compressed_table(&f->transformed, &f->ig_transformed, parsing_table, 1, &f->packed);
+    build_pratt_table(&f->transformed, &f->levels, &f->pt);
+    return 1;
+}
+
+// Operators of a level group as the level is marked, tighter levels and
+// parentheses first. Expected orders are the operator positions in postfix order.
+static char pratt_grouping_grammar[] =
+    "E -> E - T | T\nT -> T ^ F | F\nF -> ( E ) | x\noperator E left -\noperator T right ^\n";
+static const struct {
+    const char *input;
+    const char *order;
+} pratt_groupings[] = {
+    {"x - x - x", "1 3"},
+    {"x ^ x ^ x", "3 1"},
+    {"x - x ^ x ^ x - x", "5 3 1 7"},
+    {"( x - x ) ^ x ^ x", "2 7 5"},
+};
+
+// Nesting and chains far deeper than the C stack would take: D parentheses
+// around "x - x", then a chain of D right associative '^'.
+#define PRATT_DEEP 200000
+
+static int pratt_groups_deeply(PrattFixture *f, OperatorOrder *applied) {
+    int open = get_symbol_code(&f->transformed, "(") - MAX_SYMBOLS;
+    int close = get_symbol_code(&f->transformed, ")") - MAX_SYMBOLS;
+    int x = get_symbol_code(&f->transformed, "x") - MAX_SYMBOLS;
+    int minus = get_symbol_code(&f->transformed, "-") - MAX_SYMBOLS;
+    int power = get_symbol_code(&f->transformed, "^") - MAX_SYMBOLS;
+    int *sentence = checked_realloc(NULL, (2 * PRATT_DEEP + 4) * sizeof(int));
+    int n = 0;
+    for (int i = 0; i < PRATT_DEEP; i++) sentence[n++] = open;
+    sentence[n++] = x;
+    sentence[n++] = minus;
+    sentence[n++] = x;
+    for (int i = 0; i < PRATT_DEEP; i++) sentence[n++] = close;
+    sentence[n] = f->transformed.terminal_count;
+    int ok = pratt_parse(&f->ig_transformed, &f->packed, &f->pt, sentence, n + 1, applied) == n + 1 &&
+             applied->count == 1 && applied->positions[0] == PRATT_DEEP + 1;
+    n = 0;
+    sentence[n++] = x;
+    for (int i = 0; i < PRATT_DEEP; i++) {
+        sentence[n++] = power;
+        sentence[n++] = x;
+    }
+    sentence[n] = f->transformed.terminal_count;
+    ok = ok && pratt_parse(&f->ig_transformed, &f->packed, &f->pt, sentence, n + 1, applied) == n + 1 &&
+         applied->count == PRATT_DEEP;
+    for (int k = 0; k < applied->count && ok; k++) ok = applied->positions[k] == 2 * (PRATT_DEEP - k) - 1;
+    free(sentence);
+    return ok;
+}
+
+static int pratt_groups_operators(void) {
+    static PrattFixture f;
+    static OperatorOrder applied;
+    int sentence[32];
+    char input[64], order[64];
+    if (!pratt_fixture(&f, pratt_grouping_grammar)) return 0;
+    int ok = 1;
+    for (int i = 0; i < (int)(sizeof(pratt_groupings) / sizeof(pratt_groupings[0])) && ok; i++) {
+        int n = 0;
+        snprintf(input, sizeof(input), "%s", pratt_groupings[i].input);
+        for (char *word = strtok(input, " "); word; word = strtok(NULL, " ")) {
+            sentence[n++] = get_symbol_code(&f.transformed, word) - MAX_SYMBOLS;
+        }
+        sentence[n] = f.transformed.terminal_count;
+        ok = pratt_parse(&f.ig_transformed, &f.packed, &f.pt, sentence, n + 1, &applied) == n + 1;
+        size_t len = 0;
+        order[0] = '\0';
+        for (int k = 0; k < applied.count; k++) {
+            len += snprintf(order + len, sizeof(order) - len, k ? " %d" : "%d", applied.positions[k]);
+        }
+        ok = ok && strcmp(order, pratt_groupings[i].order) == 0;
+    }
+    ok = ok && pratt_groups_deeply(&f, &applied);
+    free(applied.positions);
+    free_compressed_table(&f.packed);
+    return ok;
+}
+
+// A random chain of operator levels over P -> l A r | x | n P must parse the
+// same sampled and mutated sentences with the precedence climber as with the
+// table alone.
+static int pratt_agrees(char *text, size_t size, int samples) {
+    static PrattFixture f;
+    int height[MAX_SYMBOLS];
+    int sentence[FUZZ_MAX_SAMPLE + 1];
+
+    int level_count = 1 + fuzz_rand(3);
+    size_t len = 0;
+    char op = 'a';
+    for (int l = 0; l < level_count; l++) {
+        char lhs = 'A' + l, next = l + 1 < level_count ? lhs + 1 : 'P';
+        int ops = 1 + fuzz_rand(2);
+        len += snprintf(text + len, size - len, "%c ->", lhs);
+        for (int o = 0; o < ops; o++) len += snprintf(text + len, size - len, " %c %c %c |", lhs, op + o, next);
+        len += snprintf(text + len, size - len, " %c\noperator %c %s", next, lhs, fuzz_rand(2) ? "left" : "right");
+        for (int o = 0; o < ops; o++) len += snprintf(text + len, size - len, " %c", op + o);
+        len += snprintf(text + len, size - len, "\n");
+        op += ops;
+    }
+    snprintf(text + len, size - len, "P -> l A r | x | n P\n");
+    if (!pratt_fixture(&f, text)) return 0;
+
+    int ok = 1;
+    derivation_heights(&f.ig_original, height);
+    for (int i = 0; i < samples && ok; i++) {
+        int n = sample_symbol(&f.ig_original, height, f.ig_original.start, 0, sentence, 0);
+        if (n < 0) continue;
+        for (int t = 0; t < n; t++) {
+            sentence[t] = get_symbol_code(&f.transformed, f.original.terminals[sentence[t]]) - MAX_SYMBOLS;
+        }
+        for (int mutate = 0; mutate < 2 && ok; mutate++) {
+            if (mutate && n > 0) sentence[fuzz_rand(n)] = fuzz_rand(f.transformed.terminal_count);
+            sentence[n] = f.transformed.terminal_count;
+            int expected = ll1_parse(&f.ig_transformed, &f.packed, sentence, n + 1, NULL);
+            ok = pratt_parse(&f.ig_transformed, &f.packed, &f.pt, sentence, n + 1, NULL) == expected &&
+                 (mutate || expected >= 0);
+        }
+    }
+    free_compressed_table(&f.packed);
+    return ok;
+}
+
+// Grammars that use a MAX_* limit exactly; none of them may raise capacity_error
+static const char *limit_grammars[] = {
+    "S -> a b c d e f g h i j\n",          // full alternative in a production without left recursion
+    "S -> S x | a b c d e f g h i\n",      // full once S' is appended
+};
+
+// Whether text gets through reading, left factoring and left-recursion removal
+// without a capacity error.
+static int within_limits(const char *text) {
+    static Grammar g;
+    static FILE *in;
+    jmp_buf trap;
+    capacity_trap = &trap;
+    in = NULL;
+    if (setjmp(trap)) {
+        if (in) fclose(in);
+        capacity_trap = NULL;
+        return 0;
+    }
+    in = fmemopen((char *)text, strlen(text), "r");
+    g = read_grammar(in);
+    fclose(in);
+    in = NULL;
+    g = remove_left_recursion(left_factoring(g));
+    capacity_trap = NULL;
+    return 1;
+}
+
+static void report_failure(const char *check, const char *text) {
+    fuzz_failures++;
+    if (fuzz_failures <= 5) {
+        fprintf(stderr, "FAIL (%s) on grammar:\n%s\n", check, text);
+    }
+}
+
+static int fuzz_option(int argc, char *argv[], const char *name, int fallback) {
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], name) == 0) return atoi(argv[i + 1]);
+    }
+    return fallback;
+}
+
+int main(int argc, char *argv[]) {
+    static Grammar original, factored, transformed;
+    static IndexedGrammar ig_original, ig_transformed;
+    static ReferenceSets ref_original, ref_transformed;
+    static char first_sets[MAX_SYMBOLS][MAX_SYMBOLS][MAX_SYMBOL_LENGTH];
+    static char follow_sets[MAX_SYMBOLS][MAX_SYMBOLS][MAX_SYMBOL_LENGTH];
+    static int parsing_table[MAX_SYMBOLS][MAX_SYMBOLS];
+    static char text[16384];
+    static ConflictReport conflicts, checked;
+    static SuffixSets suffix;
+    static long capacity_hits, oversize_missed, tested;
+    int first_count[MAX_SYMBOLS], follow_count[MAX_SYMBOLS];
+    FuzzLimits limits;
+    jmp_buf trap;
+
+    int count = fuzz_option(argc, argv, "--count", 10000);
+    int oversize_every = fuzz_option(argc, argv, "--oversize", 50);
+    fuzz_state += (unsigned long long)fuzz_option(argc, argv, "--seed", 1) * 0x9E3779B97F4A7C15ULL;
+    limits.max_non_terminals = fuzz_option(argc, argv, "--max-nt", 6);
+    limits.max_terminals = fuzz_option(argc, argv, "--max-terminals", 5);
+    limits.max_alternatives = fuzz_option(argc, argv, "--max-alts", 4);
+    limits.max_length = fuzz_option(argc, argv, "--max-len", 4);
+    limits.samples = fuzz_option(argc, argv, "--samples", 8);
+
+    // The pipeline reports conflicts on stdout; the harness reports on stderr.
+    if (!freopen("/dev/null", "w", stdout)) return 1;
+
+    if (!pratt_groups_operators()) report_failure("operators grouped against their levels", pratt_grouping_grammar);
+
+    // Grammars right at the limits must get through every stage
+    for (int i = 0; i < (int)(sizeof(limit_grammars) / sizeof(limit_grammars[0])); i++) {
+        if (!within_limits(limit_grammars[i])) {
+            report_failure("capacity error on a grammar within the limits", limit_grammars[i]);
+        }
+    }
+    capacity_trap = &trap;
+
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    for (int iter = 0; iter < count; iter++) {
+        volatile int oversize = (oversize_every > 0 && iter % oversize_every == oversize_every - 1) ? 1 + fuzz_rand(4) : 0;
+        if (iter % 4 == 0 && !pratt_agrees(text, sizeof(text), limits.samples)) {
+            report_failure("precedence climbing disagrees with the table driver", text);
+        }
+        generate_grammar(&limits, oversize, text, sizeof(text));
+
+        FILE *in = fmemopen(text, strlen(text), "r");
+        if (setjmp(trap)) {
+            fclose(in);
+            capacity_hits++;
+            continue;
+        }
+        original = read_grammar(in);
+        fclose(in);
+        if (oversize) {
+            // Reaching here means the reader accepted a grammar that cannot fit.
+            oversize_missed++;
+            report_failure("capacity overrun not detected", text);
+            continue;
+        }
+        factored = left_factoring(original);
+        transformed = remove_left_recursion(factored);
+        if (!grammar_within_bounds(&original) || !grammar_within_bounds(&factored) ||
+            !grammar_within_bounds(&transformed)) {
+            report_failure("array bounds", text);
+            continue;
+        }
+        tested++;
+
+        index_grammar(&original, &ig_original);
+        index_grammar(&transformed, &ig_transformed);
+        reference_sets(&ig_original, &ref_original);
+        reference_sets(&ig_transformed, &ref_transformed);
+
+        compute_first_sets(&transformed, first_sets, first_count);
+        compute_suffix_sets(&transformed, &ig_transformed, first_sets, first_count, &suffix);
+        compute_follow_sets(&transformed, &suffix, follow_sets, follow_count);
+        int sets_ok = 1;
+        for (int i = 0; i < transformed.non_terminal_count && sets_ok; i++) {
+            sets_ok = same_set(&transformed, first_sets[i], first_count[i], ref_transformed.first[i],
+                               ref_transformed.nullable[i]) &&
+                      same_set(&transformed, follow_sets[i], follow_count[i], ref_transformed.follow[i], 0);
+        }
+        if (!sets_ok) {
+            report_failure("FIRST/FOLLOW differ from reference", text);
+            continue;
+        }
+
+        // Every cell must hold one of the alternatives predicting it, and the
+        // conflict report must list exactly the cells with several.
+        construct_parsing_table(&transformed, &suffix, parsing_table, &conflicts);
+        CompressedTable packed;
+        build_compressed_table(&transformed, &ig_transformed, parsing_table, 1, &packed);
+        int table_ok = 1, expected_conflicts = 0;
+        for (int nt = 0; nt < transformed.non_terminal_count && table_ok; nt++) {
+            for (int col = 0; col <= transformed.terminal_count && table_ok; col++) {
+                int predicting = 0, holds = 0, holder_alt = -1;
+                for (int a = 0; a < ig_transformed.alt_count; a++) {
+                    IndexedAlternative *alt = &ig_transformed.alts[a];
+                    if (alt->lhs != nt || !predicts(&ig_transformed, &ref_transformed, alt, col)) continue;
+                    predicting++;
+                    if (alt->code == parsing_table[nt][col]) {
+                        holds = 1;
+                        holder_alt = a;
+                    }
+                }
+                if (predicting == 0) table_ok = parsing_table[nt][col] == -1;
+                else table_ok = holds && compressed_table_lookup(&packed, nt, col) == holder_alt;
+                if (predicting > 1) {
+                    expected_conflicts++;
+                    int listed = 0;
+                    for (int c = 0; c < conflicts.cell_count; c++) {
+                        if (conflicts.cells[c].nt_index == nt && conflicts.cells[c].col == col) {
+                            listed = conflicts.cells[c].count == predicting;
+                        }
+                    }
+                    if (!listed) table_ok = 0;
+                }
+            }
+        }
+        free_compressed_table(&packed);
+        if (!table_ok || expected_conflicts != conflicts.cell_count) {
+            report_failure("parsing table inconsistent with predict sets", text);
+            continue;
+        }
+
+        // The table-free check must agree with the table, cell for cell.
+        int check_ok = check_ll1(&suffix, NULL) == (conflicts.cell_count ? LL1_CHECK_CONFLICT : LL1_CHECK_OK) &&
+                       check_ll1(&suffix, &checked) == (conflicts.cell_count ? LL1_CHECK_CONFLICT : LL1_CHECK_OK) &&
+                       checked.cell_count == conflicts.cell_count;
+        for (int c = 0; c < checked.cell_count && check_ok; c++) {
+            ConflictCell *x = &checked.cells[c], *y = &conflicts.cells[c];
+            check_ok = x->nt_index == y->nt_index && x->col == y->col && x->count == y->count &&
+                       memcmp(x->codes, y->codes, sizeof(int) * x->count) == 0 &&
+                       memcmp(x->via_follow, y->via_follow, sizeof(int) * x->count) == 0;
+        }
+        if (!check_ok) {
+            report_failure("LL(1) check disagrees with the parsing table", text);
+            continue;
+        }
+
+        if (!gll_agrees(&transformed, &ig_transformed, &ref_transformed, &suffix, &conflicts, parsing_table,
+                        limits.samples)) {
+            report_failure("GLL parser disagrees with Earley", text);
+            continue;
+        }
+        if (conflicts.cell_count == 0 && !incremental_agrees(&transformed, &ig_transformed, parsing_table, limits.samples)) {
+            report_failure("incremental reparse differs from a full parse", text);
+            continue;
+        }
+        if (conflicts.cell_count == 0 && !profiled_agrees(&transformed, &ig_transformed, parsing_table,
+                                                          limits.samples)) {
+            report_failure("profiled layout parses differently", text);
+            continue;
+        }
+
+        // Left recursion removal only keeps the language when no non-terminal is
+        // purely left recursive (those are non-productive and get a new base case),
+        // so the reverse direction is only checked for fully productive grammars.
+        if (!sentences_preserved(&original, &ig_original, &transformed, &ig_transformed, &ref_transformed,
+                                 limits.samples)) {
+            report_failure("sentence of the original grammar rejected after transformation", text);
+            continue;
+        }
+        int height[MAX_SYMBOLS], productive = 1;
+        derivation_heights(&ig_original, height);
+        for (int i = 0; i < ig_original.non_terminal_count; i++) {
+            if (height[i] == 1 << 30) productive = 0;
+        }
+        if (productive && !sentences_preserved(&transformed, &ig_transformed, &original, &ig_original,
+                                               &ref_original, limits.samples)) {
+            report_failure("transformed grammar accepts a sentence the original does not", text);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    capacity_trap = NULL;
+    free(conflicts.cells);
+    free(checked.cells);
+    free_suffix_sets(&suffix);
+
+    double seconds = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+    fprintf(stderr, "%d grammars (%ld fully checked, %ld capacity errors caught, %ld overruns missed) "
+                    "in %.2fs, %.0f grammars/s, %ld failures\n",
+            count, tested, capacity_hits, oversize_missed, seconds, seconds > 0 ? count / seconds : 0.0,
+            fuzz_failures);
+    return fuzz_failures ? 1 : 0;
+}
+#endif